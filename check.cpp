@@ -0,0 +1,524 @@
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <map>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+#include "src/bpt.hpp"
+#include "src/sharded_bpt.hpp"
+#include "my_string.hpp"
+
+/*
+ * differential checks: random inserts, erases, finds and batches of finds on
+ * trees of every kind, each against a std::multimap of the same elements, with
+ * cursors walked both ways every so often and the files opened again halfway
+ * and at the end; an element is never inserted twice, so every erase takes
+ * one element or none
+ * logged trees are also left by a process dying without closing them, and
+ * found with a log or a journal cut short
+ * the trees live in check_files, made again for every case; the first
+ * difference is printed and ends the run with 1
+ * usage: check [ops per case] [seed]
+ */
+
+namespace fs = std::filesystem;
+
+const char *const check_dir = "check_files";
+const int check_page_size = 1024; // small pages, so that a few thousand keys need four levels
+const int check_values = 40; // values are drawn from 0 to check_values - 1
+
+struct setup {
+  const char *name;
+  bool mapped = false;
+  long long budget = default_budget;
+  CachePolicy policy = lru;
+  bool logged = false, postings = false, direct = false, concurrent = false;
+  bool flusher = false;
+  int shards = 0; // a ShardedBPlusTree of so many shards if not 0
+};
+
+int failures = 0;
+
+void Fail(const setup &now, const char *what, int step) {
+  if (!failures++) {
+    printf("%s: %s differs at step %d\n", now.name, what, step);
+  }
+}
+
+// keys: short ones, and every seventh long enough to leave a few to a leaf
+template<class Key>
+Key MakeKey(int i);
+template<>
+my_string MakeKey<my_string>(int i) {
+  std::string ret = "k" + std::to_string(i);
+  if (i % 7 == 0) {
+    ret += std::string(40 + i % 20, (char) ('a' + i % 26));
+  }
+  return my_string(ret);
+}
+template<>
+int MakeKey<int>(int i) {
+  return i * 3 - 1000;
+}
+
+template<class Key>
+using reference = std::multimap<Key, int>;
+
+// the values of key the reference has, in order
+template<class Key>
+std::vector<int> Expect(const reference<Key> &ref, const Key &key) {
+  std::vector<int> ret;
+  for (auto range = ref.equal_range(key); range.first != range.second; ++range.first) {
+    ret.push_back(range.first->second);
+  }
+  std::sort(ret.begin(), ret.end());
+  return ret;
+}
+// every element of the reference in the order of the tree, key and then value
+template<class Key>
+std::vector<std::pair<Key, int>> Elements(const reference<Key> &ref) {
+  std::vector<std::pair<Key, int>> ret;
+  for (auto it = ref.begin(); it != ref.end();) {
+    auto range = ref.equal_range(it->first);
+    for (int value : Expect(ref, it->first)) {
+      ret.emplace_back(it->first, value);
+    }
+    it = range.second;
+  }
+  return ret;
+}
+template<class Key>
+bool Has(const reference<Key> &ref, const Key &key, int value) {
+  for (auto range = ref.equal_range(key); range.first != range.second; ++range.first) {
+    if (range.first->second == value) {
+      return true;
+    }
+  }
+  return false;
+}
+std::vector<int> Got(const sjtu::vector<int> &found) {
+  std::vector<int> ret;
+  for (size_t i = 0; i < found.size(); ++i) {
+    ret.push_back(found[i]);
+  }
+  return ret;
+}
+
+template<class Key, int PageSize>
+struct plain_tree {
+  typedef BPlusTree<Key, int, PageSize> type;
+  static type *Open(const setup &now) {
+    std::string at = std::string(check_dir) + "/";
+    type *ret = new type(at + "tree", at + "data", now.mapped, now.budget, now.policy,
+                         now.logged ? at + "log" : "", now.postings, now.direct, now.concurrent);
+    if (now.flusher) {
+      ret->StartFlusher(0.05, 3);
+    }
+    return ret;
+  }
+};
+template<class Key, int PageSize>
+struct sharded_tree {
+  typedef ShardedBPlusTree<Key, int, PageSize> type;
+  static type *Open(const setup &now) {
+    std::string at = std::string(check_dir) + "/";
+    return new type(at + "tree", at + "data", now.shards, 2, now.mapped, now.budget, now.policy,
+                    now.logged ? at + "log" : "", now.postings, now.direct);
+  }
+};
+
+// a random insert or erase, of the reference and of tree if there is one
+template<class Tree, class Key>
+void Change(Tree *tree, reference<Key> &ref, std::mt19937 &rng, int keys) {
+  int op = (int) (rng() % 8);
+  Key key = MakeKey<Key>((int) (rng() % keys));
+  int value = (int) (rng() % check_values);
+  if (op < 5) {
+    if (!Has(ref, key, value)) {
+      ref.emplace(key, value);
+      if (tree) {
+        tree->insert(key, value);
+      }
+    }
+    return;
+  }
+  if (op == 7 && !ref.empty()) { // mostly an element that is there
+    auto it = ref.lower_bound(key);
+    if (it == ref.end()) {
+      it = ref.begin();
+    }
+    key = it->first, value = it->second;
+  }
+  for (auto range = ref.equal_range(key); range.first != range.second; ++range.first) {
+    if (range.first->second == value) {
+      ref.erase(range.first);
+      break;
+    }
+  }
+  if (tree) {
+    tree->erase(key, value);
+  }
+}
+
+// what only a BPlusTree has: the values through a sink, batches and walking backwards
+template<class Key, int PageSize>
+void CheckMore(BPlusTree<Key, int, PageSize> &tree, const reference<Key> &ref, const setup &now,
+               std::mt19937 &rng, int keys, int step) {
+  Key key = MakeKey<Key>((int) (rng() % keys));
+  std::vector<int> sunk;
+  int count = tree.find(key, [&sunk](const int &value) { sunk.push_back(value); });
+  if (sunk != Expect(ref, key) || count != (int) sunk.size()) {
+    Fail(now, "find into a sink", step);
+  }
+  sjtu::vector<Key> batch;
+  int batch_size = 1 + (int) (rng() % 40);
+  int first = (int) (rng() % keys);
+  for (int i = 0; i < batch_size; ++i) { // mostly ascending, as batches come, with a few out of place
+    batch.push_back(MakeKey<Key>(rng() % 5 ? (first + i * 3) % keys : (int) (rng() % keys)));
+  }
+  sjtu::vector<sjtu::vector<int>> found = tree.find_batch(batch);
+  for (int i = 0; i < batch_size; ++i) {
+    if (Got(found[i]) != Expect(ref, batch[i])) {
+      Fail(now, "find_batch", step);
+      break;
+    }
+  }
+  if (step % 4) {
+    return;
+  }
+  std::vector<std::pair<Key, int>> all = Elements(ref);
+  size_t at = all.size();
+  for (auto walk = tree.last(); walk.valid(); walk.prev()) {
+    if (!at || !(walk.key() == all[at - 1].first) || walk.value() != all[at - 1].second) {
+      Fail(now, "walking back from last", step);
+      return;
+    }
+    --at;
+  }
+  if (at) {
+    Fail(now, "walking back from last", step);
+  }
+  Key lo = MakeKey<Key>((int) (rng() % keys)), hi = MakeKey<Key>((int) (rng() % keys));
+  if (hi < lo) {
+    std::swap(lo, hi);
+  }
+  std::vector<std::pair<Key, int>> expect, got;
+  for (auto &element : all) {
+    if (!(element.first < lo) && !(hi < element.first)) {
+      expect.push_back(element);
+    }
+  }
+  tree.reverse_scan(lo, hi, [&got](const Key &key, const int &value) { got.emplace_back(key, value); });
+  std::reverse(got.begin(), got.end());
+  if (got != expect) {
+    Fail(now, "reverse_scan", step);
+  }
+}
+template<class Key, int PageSize>
+void CheckMore(ShardedBPlusTree<Key, int, PageSize> &, const reference<Key> &, const setup &,
+               std::mt19937 &, int, int) {}
+
+// every key through find, and every element in order through begin, a lower_bound and a scan
+template<class Tree, class Key>
+void CheckAll(Tree &tree, const reference<Key> &ref, const setup &now, std::mt19937 &rng, int keys, int step) {
+  for (int i = 0; i < keys; ++i) {
+    Key key = MakeKey<Key>(i);
+    if (Got(tree.find(key)) != Expect(ref, key)) {
+      Fail(now, "find of every key", step);
+      return;
+    }
+  }
+  std::vector<std::pair<Key, int>> all = Elements(ref), got;
+  for (auto walk = tree.begin(); walk.valid(); walk.next()) {
+    got.emplace_back(walk.key(), walk.value());
+  }
+  if (got != all) {
+    Fail(now, "walking from begin", step);
+  }
+  Key lo = MakeKey<Key>((int) (rng() % keys)), hi = MakeKey<Key>((int) (rng() % keys));
+  if (hi < lo) {
+    std::swap(lo, hi);
+  }
+  auto first = std::find_if(all.begin(), all.end(), [&lo](const std::pair<Key, int> &x) { return !(x.first < lo); });
+  { // gone before the scan, a thread holding a cursor making no other call
+    auto bound = tree.lower_bound(lo);
+    if (bound.valid() != (first != all.end())
+        || (bound.valid() && (!(bound.key() == first->first) || bound.value() != first->second))) {
+      Fail(now, "lower_bound", step);
+    }
+  }
+  got.clear();
+  tree.scan(lo, hi, [&got](const Key &key, const int &value) { got.emplace_back(key, value); });
+  std::vector<std::pair<Key, int>> expect;
+  for (auto it = first; it != all.end() && !(hi < it->first); ++it) {
+    expect.push_back(*it);
+  }
+  if (got != expect) {
+    Fail(now, "scan", step);
+  }
+}
+
+template<class Open, class Key>
+void Run(const setup &now, int ops, int keys, int seed) {
+  typedef typename Open::type tree_type;
+  fs::remove_all(check_dir);
+  fs::create_directory(check_dir);
+  std::mt19937 rng(seed);
+  reference<Key> ref;
+  for (int session = 0; session < 2 && !failures; ++session) { // the second on the files the first left
+    tree_type *tree = Open::Open(now);
+    for (int i = session * ops / 2; i < (session + 1) * ops / 2 && !failures; ++i) {
+      int op = (int) (rng() % 10);
+      if (op < 8) {
+        Change(tree, ref, rng, keys);
+      } else if (op < 9) {
+        Key key = MakeKey<Key>((int) (rng() % keys));
+        if (Got(tree->find(key)) != Expect(ref, key)) {
+          Fail(now, "find", i);
+        }
+      } else {
+        CheckMore(*tree, ref, now, rng, keys, i);
+      }
+      if (i % (ops / 8) == 0) {
+        CheckAll(*tree, ref, now, rng, keys, i);
+      }
+    }
+    delete tree;
+  }
+  if (!failures) {
+    tree_type *tree = Open::Open(now);
+    CheckAll(*tree, ref, now, rng, keys, ops);
+    delete tree;
+  }
+  fs::remove_all(check_dir);
+}
+
+// BulkLoadUnsorted of a shuffled reference, then the same checks
+template<class Key, int PageSize>
+void RunBulk(const setup &now, int count, int keys, int seed) {
+  typedef plain_tree<Key, PageSize> open;
+  fs::remove_all(check_dir);
+  fs::create_directory(check_dir);
+  std::mt19937 rng(seed);
+  reference<Key> ref;
+  std::vector<std::pair<Key, int>> load;
+  for (int i = 0; i < count; ++i) {
+    Key key = MakeKey<Key>((int) (rng() % keys));
+    int value = (int) (rng() % 1000);
+    if (!Has(ref, key, value)) {
+      ref.emplace(key, value);
+      load.emplace_back(key, value);
+    }
+  }
+  std::shuffle(load.begin(), load.end(), rng);
+  {
+    typename open::type *tree = open::Open(now);
+    size_t at = 0;
+    tree->BulkLoadUnsorted([&load, &at](Key &key, int &value) {
+      if (at == load.size()) {
+        return false;
+      }
+      key = load[at].first, value = load[at].second, ++at;
+      return true;
+    }, 0.9, 64 << 10);
+    CheckAll(*tree, ref, now, rng, keys, 0);
+    delete tree;
+  }
+  typename open::type *tree = open::Open(now);
+  CheckAll(*tree, ref, now, rng, keys, 1);
+  CheckMore(*tree, ref, now, rng, keys, 0);
+  delete tree;
+  fs::remove_all(check_dir);
+}
+
+/*
+ * a child process opens the logged tree, writes, waits for the log with Sync
+ * and dies without closing it, three times over; the tree opened again must
+ * hold everything the child did, or with torn all but its last insert, whose
+ * record is cut off the end of the log in the middle
+ * the parent goes through the same changes with no tree, to know what that is
+ */
+template<class Key>
+void RunCrash(const setup &now, int ops, int keys, int seed, bool torn) {
+  typedef plain_tree<Key, check_page_size> open;
+  fs::remove_all(check_dir);
+  fs::create_directory(check_dir);
+  std::mt19937 rng(seed);
+  reference<Key> ref;
+  for (int round = 0; round < 3 && !failures; ++round) {
+    Key key = MakeKey<Key>((int) (rng() % keys));
+    int value = check_values + round; // not there yet
+    pid_t child = fork();
+    if (child == 0) {
+      typename open::type *tree = open::Open(now);
+      for (int i = 0; i < ops / 3; ++i) {
+        Change(tree, ref, rng, keys);
+      }
+      tree->insert(key, value);
+      tree->Sync();
+      _exit(0);
+    }
+    for (int i = 0; i < ops / 3; ++i) {
+      Change<typename open::type>(nullptr, ref, rng, keys);
+    }
+    int status = 0;
+    if (child < 0 || waitpid(child, &status, 0) != child || !WIFEXITED(status) || WEXITSTATUS(status)) {
+      Fail(now, "the child", round);
+      break;
+    }
+    if (torn) {
+      PageFile log;
+      log.Open(std::string(check_dir) + "/log");
+      if (log.Size() < 4) { // a checkpoint took the record
+        Fail(now, "the log", round);
+        break;
+      }
+      log.Truncate(log.Size() - 3);
+    } else {
+      ref.emplace(key, value);
+    }
+    typename open::type *tree = open::Open(now);
+    CheckAll(*tree, ref, now, rng, keys, round);
+    delete tree;
+  }
+  fs::remove_all(check_dir);
+}
+
+// the whole of a file
+std::string Slurp(const std::string &name) {
+  PageFile file;
+  file.Open(name);
+  std::string ret((size_t) file.Size(), '\0');
+  file.Read(0, &ret[0], (int) ret.size());
+  return ret;
+}
+void Spill(const std::string &name, const std::string &bytes) {
+  PageFile file;
+  file.Open(name);
+  file.Truncate(0);
+  file.Write(0, bytes.data(), (int) bytes.size());
+}
+
+/*
+ * a checkpoint cut short: the files of a first session are put back, with
+ * those of a second one staged in a sealed journal and half written over them;
+ * opening must redo the journal and hold what the second session left
+ * with torn the journal loses the last byte of its seal and the files are the
+ * first session's as they were, which the tree must then hold (the second
+ * session left an empty log)
+ */
+template<class Key>
+void RunJournal(const setup &now, int ops, int keys, int seed, bool torn) {
+  typedef plain_tree<Key, check_page_size> open;
+  fs::remove_all(check_dir);
+  fs::create_directory(check_dir);
+  std::mt19937 rng(seed);
+  reference<Key> ref, before;
+  std::string at = std::string(check_dir) + "/";
+  // in the order BPlusTree attaches them to its log
+  const std::string names[] = {at + "tree", at + "data", at + "tree's garbage", at + "data's garbage"};
+  std::string old[4];
+  for (int session = 0; session < 2; ++session) {
+    typename open::type *tree = open::Open(now);
+    for (int i = 0; i < ops / 2; ++i) {
+      Change(tree, ref, rng, keys);
+    }
+    delete tree;
+    if (!session) {
+      before = ref;
+      for (int i = 0; i < 4; ++i) {
+        old[i] = Slurp(names[i]);
+      }
+    }
+  }
+  {
+    PageFile files[4];
+    WriteAheadLog log;
+    std::string fresh[4];
+    for (int i = 0; i < 4; ++i) {
+      files[i].Open(names[i]);
+      log.Attach(files[i]);
+      fresh[i] = Slurp(names[i]);
+    }
+    log.Open(at + "log");
+    for (int i = 0; i < 4; ++i) {
+      for (size_t place = 0; place < fresh[i].size(); place += check_page_size) {
+        log.Stage(i, (long long) place, fresh[i].data() + place,
+                  (int) std::min(fresh[i].size() - place, (size_t) check_page_size));
+      }
+    }
+    log.Seal();
+    for (int i = 0; i < 4; ++i) {
+      Spill(names[i], old[i]);
+      if (!torn) {
+        files[i].Write(0, fresh[i].data(), (int) fresh[i].size() / 2);
+      }
+    }
+  }
+  if (torn) {
+    PageFile journal;
+    journal.Open(at + "log's journal");
+    journal.Truncate(journal.Size() - 1);
+    ref = before;
+  }
+  typename open::type *tree = open::Open(now);
+  CheckAll(*tree, ref, now, rng, keys, 0);
+  delete tree;
+  fs::remove_all(check_dir);
+}
+
+template<class Key>
+void RunAll(int ops, int keys, int seed) {
+  const int small = check_page_size;
+  setup cases[] = {
+      {"plain"},
+      {"mapped", true},
+      {"small cache", false, 64 << 10},
+      {"clock", false, 64 << 10, clock_sweep},
+      {"2q", false, 64 << 10, two_queue},
+      {"partitioned cache", false, 512 << 10, two_queue},
+      {"flusher", false, 64 << 10, lru, false, false, false, false, true},
+      {"log", false, 64 << 10, lru, true},
+      {"postings", false, default_budget, lru, false, true},
+      {"postings and log", false, 64 << 10, lru, true, true},
+      {"concurrent", false, 64 << 10, lru, false, false, false, true},
+      {"concurrent with log", false, 64 << 10, lru, true, false, false, true},
+      {"sharded", false, 256 << 10, lru, false, false, false, false, false, 4},
+      {"sharded with log", false, 256 << 10, lru, true, false, false, false, false, 3},
+  };
+  for (const setup &now : cases) {
+    if (now.shards) {
+      Run<sharded_tree<Key, small>, Key>(now, ops, keys, seed);
+    } else {
+      Run<plain_tree<Key, small>, Key>(now, ops, keys, seed);
+    }
+  }
+  // checkpoints come often with 64K, and not at all with the default budget, which keeps the log whole
+  RunCrash<Key>(setup{"crash", false, 64 << 10, lru, true}, ops, keys, seed, false);
+  RunCrash<Key>(setup{"crash with a torn record", false, default_budget, lru, true}, ops, keys, seed, true);
+  RunJournal<Key>(setup{"sealed journal", false, 64 << 10, lru, true}, ops, keys, seed, false);
+  RunJournal<Key>(setup{"torn journal", false, 64 << 10, lru, true}, ops, keys, seed, true);
+  setup direct{"direct"};
+  direct.direct = true, direct.budget = 256 << 10;
+  Run<plain_tree<Key, direct_alignment>, Key>(direct, ops, keys, seed);
+  RunBulk<Key, small>(setup{"bulk load"}, ops, keys, seed);
+  setup bulk_postings{"bulk load with postings"};
+  bulk_postings.postings = true;
+  RunBulk<Key, small>(bulk_postings, ops, keys / 8, seed);
+}
+
+int main(int argc, char **argv) {
+  int ops = argc > 1 ? std::max(16, atoi(argv[1])) : 20000;
+  int seed = argc > 2 ? atoi(argv[2]) : 1;
+  RunAll<my_string>(ops, 2000, seed);
+  RunAll<int>(ops, 2000, seed);
+  if (failures) {
+    return 1;
+  }
+  puts("ok");
+  return 0;
+}
@@ -1,32 +1,10 @@
 #include <iostream>
 #include "src/bpt.hpp"
+#include "my_string.hpp"
 #include <string>
 
 using namespace std;
 
-class my_string {
- private:
-  char info[65];
- public:
-  my_string &operator=(const my_string &other) {
-    strcpy(info, other.info);
-    return *this;
-  }
-  friend ostream &operator<<(ostream &out, const my_string &obj) {
-    out << obj.info;
-    return out;
-  }
-  my_string(const string &obj = "") {
-    strcpy(info, obj.c_str());
-  }
-  friend bool operator<(const my_string &obj_1, const my_string &obj_2) {
-    return strcmp(obj_1.info, obj_2.info) < 0;
-  }
-  friend bool operator==(const my_string &obj_1, const my_string &obj_2) {
-    return strcmp(obj_1.info, obj_2.info) == 0;
-  }
-};
-
 int main() {
   freopen("fcyyu.in", "r", stdin);
   freopen("bptout.txt", "w", stdout);
@@ -46,11 +24,8 @@ int main() {
       pool.insert(name, year);
     }
     if (operation == "find") {
-      auto ret = pool.find(name);
-      if (!ret.empty()) {
-        for (int j = 0; j < ret.size(); ++j) {
-          cout << ret[j] << ' ';
-        }
+      // printed as they are found
+      if (pool.find(name, [](const int &year) { cout << year << ' '; })) {
         cout << '\n';
       }
       else {
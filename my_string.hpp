@@ -0,0 +1,57 @@
+#ifndef BPT_MY_STRING_HPP_
+#define BPT_MY_STRING_HPP_
+#include <cstring>
+#include <ostream>
+#include <string>
+#include "src/bpt.hpp"
+
+class my_string {
+  friend struct KeyTraits<my_string>;
+ private:
+  char info[65];
+ public:
+  my_string &operator=(const my_string &other) {
+    if (this != &other) {
+      strcpy(info, other.info);
+    }
+    return *this;
+  }
+  friend std::ostream &operator<<(std::ostream &out, const my_string &obj) {
+    out << obj.info;
+    return out;
+  }
+  my_string(const my_string &other) {
+    strcpy(info, other.info);
+  }
+  my_string(const std::string &obj = "") {
+    strcpy(info, obj.c_str());
+  }
+  friend bool operator<(const my_string &obj_1, const my_string &obj_2) {
+    return strcmp(obj_1.info, obj_2.info) < 0;
+  }
+  friend bool operator==(const my_string &obj_1, const my_string &obj_2) {
+    return strcmp(obj_1.info, obj_2.info) == 0;
+  }
+};
+
+// only the characters in use go into the pages, and the '\0' ending them,
+// which sorts a string before the longer ones it starts
+template<>
+struct KeyTraits<my_string> {
+  static const bool ordered = true;
+  static const bool normalized = true;
+  static int Size(const my_string &key) {
+    return (int) strlen(key.info) + 1;
+  }
+  static void Encode(const my_string &key, char *to) {
+    memcpy(to, key.info, strlen(key.info) + 1);
+  }
+  static void Decode(const char *from, int size, my_string &key) {
+    if (size && !from[size - 1]) { // separators may be cut short of the '\0'
+      --size;
+    }
+    memcpy(key.info, from, size);
+    key.info[size] = '\0';
+  }
+};
+#endif //BPT_MY_STRING_HPP_
@@ -1,161 +1,489 @@
 #ifndef BPT__BPT_HPP_
 #define BPT__BPT_HPP_
+#include <algorithm>
+#include <chrono>
+#include <climits>
 #include <cstring>
-#include <fstream>
 #include <iostream>
+#include <mutex>
+#include <shared_mutex>
 #include <string>
 #include "../utils/CacheList.hpp"
+#include "../utils/ExternalSort.hpp"
+#include "../utils/KeySearch.hpp"
+#include "../utils/KeyTraits.hpp"
+#include "../utils/MappedFile.hpp"
+#include "../utils/PageFile.hpp"
+#include "../utils/PageLatch.hpp"
+#include "../utils/PostingCodec.hpp"
 #include "../utils/recycle.hpp"
+#include "../utils/SlottedPage.hpp"
+#include "../utils/WriteAheadLog.hpp"
 #include "vector.hpp"
 
-const int max_size = 202, min_size = 101;
-const int max_son = 202, min_son = 101;
+const int default_page_size = 16384; // bytes of a node or a leaf
 
 /*
- * @supplementary functions
- * these are several means to locate specific element
- * including upper_bound, lower_bound, lower_search and binary_search
+ * PageSize sets the bytes of every node, leaf and posting page, from 1 KiB up to
+ * 64 KiB (records are addressed by 16-bit offsets); how many sons or elements
+ * fit follows from it and from the encoded sizes of the keys and values
+ * the longest record a page takes is page_size / 16 bytes, or more if the
+ * largest key (see KeyMaxSize) with a value or a posting list head needs more;
+ * a page too small to hold a few of those fails to compile
+ * files remember the page size they were made with, and open only with it
  */
-template<class T>
-int LowerBound(T val, T *array, int l, int r) {
-  int ans = r + 1;
-  while (l <= r) {
-    int mid = (l + r) >> 1;
-    if (val < array[mid]) {
-      r = mid - 1, ans = mid;
-    } else {
-      l = mid + 1;
-    }
-  }
-  return ans;
-}
-template<class T>
-int LowerSearch(T val, T *array, int l, int r) {
-  int ans = r + 1;
-  while (l <= r) {
-    int mid = (l + r) >> 1;
-    if (val < array[mid] || val == array[mid]) {
-      r = mid - 1, ans = mid;
-    } else {
-      l = mid + 1;
-    }
-  }
-  return ans;
-}
-template<class T>
-int UpperBound(T val, T *array, int l, int r) {
-  int ans = 0;
-  while (l <= r) {
-    int mid = (l + r) >> 1;
-    if (!(val < array[mid])) {
-      l = mid + 1, ans = mid;
-    } else {
-      r = mid - 1;
-    }
-  }
-  return ans;
-}
-template<class T>
-int BinarySearch(T val, T *array, int l, int r) {
-  int ans = r + 1;
-  while (l <= r) {
-    int mid = (l + r) >> 1;
-    if (val.key < array[mid].key) {
-      r = mid - 1;
-    } else if (array[mid].key < val.key) {
-      l = mid + 1;
-    } else {
-      r = mid - 1, ans = mid;
-    }
-  }
-  return ans;
-}
-
-template<class Key, class T>
+template<class Key, class T, int PageSize = default_page_size>
 class BPlusTree {
-  enum NodeState { leaf, middle };
+  static_assert(PageSize >= 1024 && PageSize <= 65536 && (PageSize & (PageSize - 1)) == 0,
+                "pages are a power of two between 1 KiB and 64 KiB");
+  static const int page_size = PageSize;
+  enum LogOp { log_insert, log_erase };
  private:
   bin tree_bin, data_bin;
-  std::fstream tree, data;
+  PageFile tree, data;
   std::string tree_name, data_name;
+  bool mapped; // pages are reached through tree_map/data_map instead of the files
+  bool direct; // the files bypass the kernel's page cache
+  MappedFile tree_map, data_map;
   struct element {
     Key key;
     T value;
 
     inline friend bool operator<(const element &cmp_1, const element &cmp_2) {
       return cmp_1.key < cmp_2.key
-          || cmp_1.key == cmp_2.key && cmp_1.value < cmp_2.value;
+          || (cmp_1.key == cmp_2.key && cmp_1.value < cmp_2.value);
     }
 
     inline friend bool operator==(const element &cmp_1, const element &cmp_2) {
       return cmp_1.key == cmp_2.key && cmp_1.value == cmp_2.value;
     }
+    element(const element &) = default;
     element &operator=(const element &obj) {
       key = obj.key;
       value = obj.value;
       return *this;
     }
-    element() : key(""), value(T()) {}
+    element() : key(), value(T()) {}
     element(const Key &index, const T &number) : key(index), value(number) {}
   };
+  /*
+   * blocks are referred to by 64-bit page numbers: page p of the tree file is the
+   * node at byte p * sizeof(node), likewise for leaves; page 0 holds the header
+   * of the file, so 0 never names a block
+   * a node or leaf is exactly one page and is stored as it is laid out in memory,
+   * so with pages of 4 KiB or more every block sits on 4 KiB boundaries
+   *
+   * both are slotted pages of encoded elements, the key taking only the bytes
+   * KeyTraits gives it, so the fan-out follows the real size of the keys
+   * a leaf record is an element; a node record is the page of a son followed by
+   * the element separating it from the son before, and the first son, which has
+   * no separator, sits in the header (sons are counted from 1)
+   * the bytes every separator of a node starts with are kept once, in the header,
+   * and cut off the records; separators themselves are as short as the keys allow
+   * (see Separate), which together leave room for many more sons
+   * every node also links to the next one of its level, right, and keeps the
+   * separator in front of that one in their father as its high key: nothing in
+   * the node is above it, so a node just split off is reached through its left
+   * neighbour before its father hears of it (a B-link tree, see @latching)
+   */
+  static constexpr int max_prefix = 64; // constexpr: std::min takes it by reference
+  // integral keys keep whole separators, which the key column of the node is read from
+  static constexpr bool whole_separators = std::is_integral<Key>::value;
+  static constexpr int prefix_limit = whole_separators ? 0 : max_prefix;
+  // the longest record: an element, or with postings a key and the head of its list
+  static const int largest_record = KeyMaxSize<Key>::value
+      + std::max((int) sizeof(T), 1 + (int) sizeof(long long) + PostingCodec<T>::MaxSize() + (int) sizeof(unsigned short));
+  static const int max_record = std::max(page_size / 16, largest_record);
+  static const int node_capacity = page_size - 3 * sizeof(long long) - 4 * sizeof(int) - max_prefix - max_record
+      - slotted_header;
+  static const int leaf_capacity = page_size - 3 * sizeof(long long) - slotted_header;
+  // whether encoded elements compare with memcmp (see KeyTraits), and searches do that
+  static const bool bytewise = KeyTraits<Key>::normalized && KeyTraits<T>::normalized;
+  /*
+   * nodes of integral keys carry them as a column of 64-bit integers as well
+   * (see SlottedPage), the key being the first bytes of a separator, after the
+   * son; leaves go without, 8 bytes a record costing them too many elements
+   * for the few searches they see
+   */
+  template<int Skip>
+  struct key_column {
+    static long long Of(const char *record) {
+      Key key;
+      KeyTraits<Key>::Decode(record + Skip, sizeof(Key), key);
+      return SearchOrder(key);
+    }
+  };
+  typedef SlottedPage<node_capacity, typename std::conditional<std::is_integral<Key>::value,
+                                                               key_column<sizeof(long long)>, void>::type> node_page;
+  typedef SlottedPage<leaf_capacity> leaf_page;
+  static_assert(node_capacity >= 4 * (max_record + (int) sizeof(long long) + node_page::slot_size)
+                    && leaf_capacity >= 4 * (max_record + leaf_page::slot_size),
+                "pages hold four of the longest records at least: PageSize is too small for the keys");
   struct node {
-    int address = 0;
-    bool changed = false;
-    NodeState state = middle;
-    int son_num = 0, son_pos[max_son + 1];
-    element index[max_son + 1];
-    node(bool did = false) : changed(did) {}
-  } current_node;
+    long long address = 0;
+    long long first_son = 0; // 0 only in an empty root
+    long long right = 0; // 0 for the last node of its level
+    int level = 1; // 1 for the fathers of leaves, one more every level up
+    int prefix_size = 0;
+    int high_size = 0;
+    int spare = 0; // keeps the records 8-byte aligned
+    char prefix[max_prefix];
+    char high[max_record]; // the high key, in full, if there is a node to the right
+    node_page records;
+
+    int Sons() const {
+      return first_son ? records.Count() + 1 : 0;
+    }
+    long long Son(int i) const {
+      long long ret = first_son;
+      if (i > 1) {
+        memcpy(&ret, records.Record(i - 2), sizeof(long long));
+      }
+      return ret;
+    }
+    // a copy of other, which a writer may be changing meanwhile (see Descend)
+    void CopyFrom(const node &other) {
+      address = other.address, first_son = other.first_son, right = other.right, level = other.level;
+      prefix_size = other.prefix_size, high_size = other.high_size;
+      memcpy(prefix, other.prefix, max_prefix);
+      memcpy(high, other.high, high_size < 0 ? 0 : high_size < max_record ? high_size : max_record);
+      records.CopyFrom(other.records);
+    }
+    // writes the separator in front of son i (i > 1) to to, returning its size
+    int Separator(int i, char *to) const {
+      int size = records.Size(i - 2) - (int) sizeof(long long);
+      memcpy(to, prefix, prefix_size);
+      memcpy(to + prefix_size, records.Record(i - 2) + sizeof(long long), size);
+      return prefix_size + size;
+    }
+  };
+  // leaves are linked both ways, in order
   struct leaves {
-    int address = 0;
-    bool changed = false;
-    int next_pos = 0, data_num = 0;
-    element storage[max_size + 1];
-    leaves(bool did = false) : changed(did) {}
-  } current_leaf;
+    long long address = 0;
+    long long next_pos = 0;
+    long long prev_pos = 0;
+    leaf_page records;
+  };
+  /*
+   * with postings on, a leaf record is a key with all of its values instead: the
+   * key, a PostingKind byte followed by either the encoded values or, once they
+   * outgrow max_record, the first page of a chain of posting pages, each holding
+   * a sorted run of them, and last the key size (an unsigned short), so the key
+   * starts the record as it does an element
+   * posting pages live in the data file next to the leaves
+   */
+  enum PostingKind : char { inline_list, overflow_list };
+  static const int posting_capacity = page_size - 2 * sizeof(long long) - sizeof(int);
+  static const int posting_tail = sizeof(unsigned short);
+  struct posting_page {
+    long long address = 0;
+    long long next_pos = 0;
+    int size = 0;
+    char bytes[posting_capacity];
+  };
+  static_assert(sizeof(node) == page_size && sizeof(leaves) == page_size && sizeof(posting_page) == page_size,
+                "pages are page_size bytes");
+  // a page below this many bytes in use gets merged with, or fed by, a sibling
+  static const int node_underflow = node_capacity / 4, leaf_underflow = leaf_capacity / 4;
+  // an element to go into a father: the new son and its separator
+  struct split_info {
+    long long page;
+    int size;
+    char separator[max_record];
+  };
+  // node records written out in full, son and whole separator, while nodes are rebuilt
+  struct wide_records {
+    std::string bytes;
+    sjtu::vector<int> offset, size;
+
+    int Count() const {
+      return (int) offset.size();
+    }
+    const char *Record(int i) const {
+      return bytes.data() + offset[i];
+    }
+    int Size(int i) const {
+      return size[i];
+    }
+    void Add(const char *record, int num) {
+      offset.push_back((int) bytes.size()), size.push_back(num);
+      bytes.append(record, num);
+    }
+    // records [begin, end) of from
+    void Add(const node &from, int begin, int end) {
+      char record[max_record + sizeof(long long)];
+      for (int i = begin; i < end; ++i) {
+        memcpy(record, from.records.Record(i), sizeof(long long));
+        Add(record, from.Separator(i + 2, record + sizeof(long long)) + (int) sizeof(long long));
+      }
+    }
+    // bytes separators i and j start with, up to prefix_limit
+    int Same(int i, int j) const {
+      const char *one = Record(i) + sizeof(long long), *another = Record(j) + sizeof(long long);
+      int most = std::min(std::min(Size(i), Size(j)) - (int) sizeof(long long), prefix_limit), ret = 0;
+      while (ret < most && one[ret] == another[ret]) {
+        ++ret;
+      }
+      return ret;
+    }
+    // how many bytes the separators of [begin, end) all start with
+    int Common(int begin, int end) const {
+      int ret = begin < end ? std::min(Size(begin) - (int) sizeof(long long), prefix_limit) : 0;
+      for (int i = begin + 1; i < end && ret; ++i) {
+        ret = std::min(ret, Same(begin, i));
+      }
+      return ret;
+    }
+    /*
+     * where to split [begin, end) in two nodes with record k going up: both
+     * [begin, k) and (k, end) must fit once packed, and they take about the same
+     * bytes; a part's records grow when it shares less than the node they came
+     * from, so every k is weighed with the prefix its parts really get
+     * -1 if there is no such k
+     */
+    int Middle(int begin, int end) const {
+      const int slot = node_page::slot_size;
+      sjtu::vector<int> right; // right[k - begin]: bytes (k, end) takes
+      int common = 0, total = 0;
+      for (int k = end - 1; k >= begin; --k) {
+        right.push_back(total - (end - 1 - k) * common);
+        common = k == end - 1 ? std::min(Size(k) - (int) sizeof(long long), prefix_limit)
+                              : std::min(common, Same(end - 1, k));
+        total += Size(k) + slot;
+      }
+      int ret = -1, best = 0;
+      common = 0, total = 0;
+      for (int k = begin; k < end; ++k) {
+        int left = total - (k - begin) * common, other = right[end - 1 - k];
+        if (left <= node_capacity && other <= node_capacity && (ret == -1 || std::abs(left - other) < best)) {
+          ret = k, best = std::abs(left - other);
+        }
+        common = k == begin ? std::min(Size(k) - (int) sizeof(long long), prefix_limit)
+                            : std::min(common, Same(begin, k));
+        total += Size(k) + slot;
+      }
+      return ret;
+    }
+  };
   struct begin_tree {
-    int start_place = sizeof(begin_tree);
-    int end_place = sizeof(begin_tree) + sizeof(node);
+    long long start_place = 1; // the root
+    long long end_place = 2; // the first page never used
+    long long log_lsn = 0; // the last logged operation the files contain
+    int page_bytes = page_size; // the page size the files were made with
   } tree_begin;
   struct begin_data {
-    int start_place = sizeof(begin_data);
-    int end_place = sizeof(begin_data);
+    long long start_place = 1; // the first leaf
+    long long end_place = 1;
+    bool postings = false; // the layout the leaves were made with
   } data_begin;
   const int node_size = sizeof(node);
   const int leaf_size = sizeof(leaves);
-  CachePool<node> node_cache;
-  CachePool<leaves> leaf_cache;
+  CachePool cache; // nodes and leaves share one budget
+  int tree_file, data_file; // their indices inside the cache
+  typedef CachePool::handle<node> node_handle;
+  typedef CachePool::handle<leaves> leaf_handle;
+  typedef CachePool::handle<posting_page> posting_handle;
+  // a leaf as readers hold it: pinned and, when concurrent, latched shared until the object goes
+  class shared_leaf {
+    friend class BPlusTree;
+    PageLatches *latches = nullptr; // those it is latched in, if any
+    leaf_handle leaf;
+   public:
+    shared_leaf() = default;
+    shared_leaf(shared_leaf &&other) noexcept : latches(other.latches), leaf(std::move(other.leaf)) {
+      other.latches = nullptr;
+    }
+    shared_leaf &operator=(shared_leaf &&other) noexcept {
+      if (this != &other) {
+        Release();
+        latches = other.latches, leaf = std::move(other.leaf);
+        other.latches = nullptr;
+      }
+      return *this;
+    }
+    ~shared_leaf() {
+      Release();
+    }
+    leaves *operator->() const {
+      return leaf.operator->();
+    }
+    explicit operator bool() const {
+      return (bool) leaf;
+    }
+    void Release() {
+      if (leaf && latches) {
+        latches->UnlockShared(leaf->address);
+      }
+      latches = nullptr;
+      leaf.Release();
+    }
+  };
+  // the write-ahead log, if any: with it dirty blocks stay cached between checkpoints
+  std::string log_name;
+  bool logged;
+  WriteAheadLog log;
+  int tree_bin_file, data_bin_file; // indices inside the log
+  std::atomic<long long> logged_bytes{0};
+  long long checkpoint_bytes;
+  int checkpoint_ms = 0;
+  std::chrono::steady_clock::time_point next_checkpoint;
+  /*
+   * @latching
+   * with concurrent on, find, insert, erase and cursors may be called from many
+   * threads at once: every node and leaf has a reader/writer latch (see
+   * PageLatch.hpp)
+   * nobody latches a node on the way down: searches copy every node and check
+   * its version afterwards, and a son's father once more after the son's version
+   * is taken, starting again from the root if either moved (optimistic lock
+   * coupling, see WalkOptimistic); so the nodes every search goes through, the
+   * root first, are written by none but the writers changing them
+   * nodes above the fathers of leaves, few and read by everyone, are kept in
+   * the cache once read (see CachePool::Keep) and copied straight from their
+   * frames, with no latch of the cache either; the fathers of leaves are pinned
+   * as usual while they are copied
+   * a writer latches the father of its leaf alone, shared if the leaf has room
+   * for whatever the change does to it, exclusive otherwise, and then the leaf;
+   * a split leaves its upper half linked to the right of the node, with a high
+   * key, and lets go before the level above is searched for the place of the new
+   * son, so a split holds a single node at a time, and whoever comes in between
+   * follows right past the high key; a node falling short is evened out the
+   * same way, from its father down, but only with a sibling right next to it
+   * (a split not finished in between leaves it short for a while)
+   * so nodes are latched from the top down and, on a level, left to right, and
+   * leaves, after their father, left to right alone: an erase lets go of its
+   * leaf before taking the one in front of it, which is what lets find and
+   * cursors walk on along next_pos holding one leaf while they take the next
+   * (going back, a cursor lets go first and checks that nothing moved, see
+   * cursor::settle)
+   * new pages need no latch, nothing reaching them before the writer making
+   * them is done; freed ones are let go of before they go back to the bins,
+   * which have a mutex of their own
+   * a cursor holds its leaf shared, and a writer waiting for that leaf holds
+   * the father and keeps new readers off the leaf, so a thread holding a cursor
+   * that searches again may wait for the writer, which waits for the cursor:
+   * while it holds a cursor a thread must make no other call on the tree, and
+   * the f of scan and reverse_scan must not touch the tree
+   * with a log, writers share gate, and checkpoints take it alone
+   */
+  bool concurrent;
+  PageLatches node_latches, leaf_latches;
+  std::mutex alloc_latch; // the bins and the ends of the files
+  std::shared_mutex gate;
  public:
-  friend class CachePool<node>;
-  friend class CachePool<leaves>;
-  node root;
-  BPlusTree(const std::string &_tree_name, const std::string &_data_name)
-      : tree_name(_tree_name),
-        data_name(_data_name),
-        tree_bin(_tree_name + "'s garbage"),
+  /*
+   * cache_budget is the memory, in bytes, the cache may spend on nodes and leaves
+   * cache_policy picks the blocks it gives up (see CacheList.hpp)
+   * with a log_name every insert and erase is logged first (see WriteAheadLog.hpp)
+   * and replayed when the tree is opened after a crash; ignored when mapped
+   * with postings each key keeps its values in a single sorted, compressed list
+   * (see PostingCodec.hpp) rather than a record apiece, which suits keys with
+   * many values; only new files take it, existing ones keep their layout
+   * with direct the files are opened with O_DIRECT (see PageFile.hpp), leaving
+   * the caching to cache alone; pages must then be multiples of direct_alignment
+   * with concurrent the tree may be searched and changed from many threads at
+   * once (see @latching); BulkLoad, Traverse and StartFlusher still want it alone
+   */
+  BPlusTree(const std::string &_tree_name, const std::string &_data_name,
+            bool _mapped = false, long long cache_budget = default_budget,
+            CachePolicy cache_policy = lru, const std::string &_log_name = "", bool postings = false,
+            bool _direct = false, bool _concurrent = false)
+      : tree_bin(_tree_name + "'s garbage"),
         data_bin(_data_name + "'s garbage"),
-        node_cache(tree),
-        leaf_cache(data) {
+        tree_name(_tree_name),
+        data_name(_data_name),
+        mapped(_mapped),
+        direct(_direct && !_mapped),
+        cache(cache_budget, cache_policy),
+        log_name(_log_name),
+        logged(!_mapped && !_log_name.empty()),
+        checkpoint_bytes(cache_budget / 4),
+        concurrent(_concurrent) {
+    if (direct && page_size % direct_alignment) {
+      throw sjtu::runtime_error();
+    }
+    data_begin.postings = postings;
+    tree_file = cache.Attach(tree), data_file = cache.Attach(data);
     init();
   }
   ~BPlusTree() {
-    UpdateTree(), UpdateData();
-    tree.seekp(root.address);
-    tree.write(reinterpret_cast<char *>(&root), node_size);
+    if (logged) {
+      Checkpoint();
+      log.Close();
+    } else {
+      UpdateTree(), UpdateData();
+    }
   };
 
+  /*
+   * writes dirty blocks in the background: whenever more than dirty_ratio of the
+   * cache budget is dirty, and all of them every checkpoint_ms milliseconds (0: never)
+   * does nothing when mapped, the kernel already writes the mapping back
+   * with a log the same two limits trigger checkpoints instead, taken between operations
+   */
+  void StartFlusher(double dirty_ratio = 0.25, int _checkpoint_ms = 1000) {
+    if (logged) {
+      checkpoint_bytes = (long long) (dirty_ratio * cache.Budget());
+      checkpoint_ms = _checkpoint_ms;
+      next_checkpoint = std::chrono::steady_clock::now() + std::chrono::milliseconds(checkpoint_ms);
+    } else if (!mapped) {
+      cache.StartFlusher(dirty_ratio, _checkpoint_ms);
+    }
+  }
+
+  /*
+   * brings the files up to date with every operation so far
+   * with a log the blocks go through its journal, so the files hold either this
+   * checkpoint or the previous one whenever the process dies, and the log restarts empty
+   * concurrent writers wait for it with a log; without one they go on meanwhile
+   */
+  void Checkpoint() {
+    std::unique_lock<std::shared_mutex> alone(gate, std::defer_lock);
+    if (concurrent && logged) {
+      alone.lock();
+    }
+    TakeCheckpoint();
+  }
+
+  // waits until every insert and erase so far is in the log on disk (no-op without a log)
+  void Sync() {
+    if (logged) {
+      log.Commit();
+    }
+  }
+
+  // hits and misses of the cache since the tree was opened (always empty when mapped)
+  CacheStats CacheStatistics() const {
+    return cache.Stats();
+  }
+  void ResetCacheStatistics() {
+    cache.ResetStats();
+  }
+
   void Traverse() {
     std::cout << "traversing\n";
-    ReadLeaf(current_leaf, data_begin.start_place);
+    if (ReadNode(tree_begin.start_place)->Sons() == 0) {
+      return;
+    }
+    leaf_handle now = ReadLeaf(data_begin.start_place);
+    element todo;
     while (true) {
       std::cout << "//";
-      for (int i = 1; i <= current_leaf.data_num; ++i) {
-        std::cout << current_leaf.storage[i].key << ' ' << current_leaf.storage[i].value << '/';
+      for (int i = 0; i < now->records.Count(); ++i) {
+        if (data_begin.postings) {
+          KeyOf(now->records.Record(i), now->records.Size(i), todo.key);
+          std::cout << todo.key;
+          ForEachPosting(now->records.Record(i), now->records.Size(i), [](const T &value) {
+            std::cout << ' ' << value;
+          });
+          std::cout << '/';
+          continue;
+        }
+        Decode(now->records.Record(i), now->records.Size(i), todo);
+        std::cout << todo.key << ' ' << todo.value << '/';
       }
-      WriteLeaves(current_leaf);
-      if (current_leaf.next_pos) {
+      if (now->next_pos) {
         std::cout << '\n';
-        ReadLeaf(current_leaf, current_leaf.next_pos);
+        now = ReadLeaf(now->next_pos);
       } else {
         std::cout << '\n';
         return;
@@ -164,472 +492,2122 @@ class BPlusTree {
   }
 
   sjtu::vector<T> find(const Key &key) {
-    element another(key, -1);
     sjtu::vector<T> ret;
-    current_node = root;
-    while (current_node.state != leaf) {
-      if (current_node.son_num == 0) {
-        return ret;
+    find_into(key, ret);
+    return ret;
+  }
+  // the same into ret, emptied first, so that one buffer serves call after call
+  void find_into(const Key &key, sjtu::vector<T> &ret) {
+    ret.clear();
+    find(key, [&ret](const T &now) { ret.push_back(now); });
+  }
+  /*
+   * hands the values of key to sink in order, straight off the leaves: sink is
+   * called with each if it takes a const T &, and is an output iterator
+   * written through otherwise; returns how many there were
+   */
+  template<class Sink>
+  int find(const Key &key, Sink sink) {
+    int ret = 0;
+    auto emit = [&sink, &ret](const T &now) {
+      if constexpr (std::is_invocable<Sink &, const T &>::value) {
+        sink(now);
+      } else {
+        *sink++ = now;
       }
-      int place = LowerBound(another, current_node.index, 1, current_node.son_num - 1);
-      ReadNode(current_node, current_node.son_pos[place]);
-      WriteNode(current_node);
+      ++ret;
+    };
+    // the leftmost leaf that may hold key (with postings there is only one, see SonOf)
+    probe look(element(key, T()), false);
+    shared_leaf now_leaf = LeafOf(look, data_begin.postings);
+    if (!now_leaf) {
+      return ret;
     }
-    if (current_node.son_num == 0) {
+    if (data_begin.postings) {
+      const leaf_page &page = now_leaf->records;
+      int pos = SearchKey(page, look);
+      Key found;
+      if (pos < page.Count()) {
+        KeyOf(page.Record(pos), page.Size(pos), found);
+        if (!(key < found)) {
+          ForEachPosting(page.Record(pos), page.Size(pos), emit);
+        }
+      }
       return ret;
     }
-    int search = LowerSearch(another, current_node.index, 1, current_node.son_num - 1);
-    ReadLeaf(current_leaf, current_node.son_pos[search]);
-    int pos = BinarySearch(another, current_leaf.storage, 1, current_leaf.data_num);
+    int pos = Search(now_leaf->records, look, false);
+    element todo;
     while (true) {
-      for (int i = pos; i <= current_leaf.data_num; ++i) {
-        if (current_leaf.storage[i].key == key) {
-          ret.push_back(current_leaf.storage[i].value);
-        } else {
-          WriteLeaves(current_leaf);
+      for (int i = pos; i < now_leaf->records.Count(); ++i) {
+        if (!look.Matches(now_leaf->records.Record(i), now_leaf->records.Size(i), todo)) {
           return ret;
         }
+        emit(todo.value);
       }
-      WriteLeaves(current_leaf);
-      if (current_leaf.next_pos) { // getting next leaf
-        ReadLeaf(current_leaf, current_leaf.next_pos);
-        pos = 1;
+      if (now_leaf->next_pos) { // getting next leaf, latched before this one is let go
+        now_leaf = ReadShared(now_leaf->next_pos);
+        pos = 0;
       } else break;
     }
     return ret;
   }
 
-  void insert(const Key &key, const T &val) {
-    element another(key, val);
-    if (root.son_num == 0) { // nothing exist, first insert
-      leaves first_leaf(false);
-      first_leaf.address = data_begin.start_place;
-      if (data_begin.start_place == data_begin.end_place) {
-        data_begin.end_place += leaf_size;
-      }
-      first_leaf.data_num = 1, first_leaf.storage[1] = another;
-      root.son_num = 1, root.son_pos[1] = first_leaf.address;
-      data.seekp(first_leaf.address);
-      data.write(reinterpret_cast<char *>(&first_leaf), sizeof(first_leaf));
-      WriteLeaves(first_leaf);
-      return;
+  sjtu::vector<sjtu::vector<T>> find_batch(const sjtu::vector<Key> &keys) {
+    sjtu::vector<sjtu::vector<T>> ret;
+    find_batch_into(keys, ret);
+    return ret;
+  }
+  /*
+   * the values of every key of keys into ret, ret[i] being those of keys[i]
+   * (the vectors ret already has are emptied and kept, as in find_into): the
+   * keys are searched for in order, each walking down only from where its path
+   * parts with the one before (see batch_path) and staying on the leaf the one
+   * before ended on if it may start there, so a batch reads every node and leaf
+   * on its way once
+   */
+  void find_batch_into(const sjtu::vector<Key> &keys, sjtu::vector<sjtu::vector<T>> &ret) {
+    int count = (int) keys.size();
+    while ((int) ret.size() > count) {
+      ret.pop_back();
     }
-    if (!InternalInsert(root, another)) {// root splitting
-      node new_root(false), vice_root(false);
-      vice_root.state = root.state, new_root.state = middle;
-      root.son_num = vice_root.son_num = min_son;
-      for (int i = 1; i <= min_son; ++i) {
-        vice_root.son_pos[i] = root.son_pos[i + min_son];
-      }
-      for (int i = 1; i < min_son; ++i) {
-        vice_root.index[i] = root.index[i + min_son];
-      }
-      if (tree_bin.empty()) {
-        vice_root.address = tree_begin.end_place, tree_begin.end_place += node_size;
-      } else {
-        vice_root.address = tree_bin.pop_back();
-      }
-      new_root.address = root.address;
-      if (tree_bin.empty()) {
-        root.address = tree_begin.end_place, tree_begin.end_place += node_size;
-      } else {
-        root.address = tree_bin.pop_back();
-      }
-      new_root.son_num = 2;
-      new_root.index[1] = root.index[min_son];
-      new_root.son_pos[1] = root.address, new_root.son_pos[2] = vice_root.address;
-      tree.seekp(vice_root.address);
-      tree.write(reinterpret_cast<char *>(&vice_root), node_size);
-      tree.seekp(root.address);
-      tree.write(reinterpret_cast<char *>(&root), node_size);
-      WriteNode(root), WriteNode(vice_root);
-      root = new_root;
+    for (int i = 0; i < (int) ret.size(); ++i) {
+      ret[i].clear();
     }
-  }
-
-  void erase(const Key &key, const T &val) {
-    element another(key, val);
-    bool checker = InternalErase(another, root);
-    if (!checker && root.state == middle && root.son_num == 1) {
-      // lowering the tree
-      node new_root;
-      ReadNode(new_root, root.son_pos[1]);
-      tree_bin.push_back(new_root.address);
-      new_root.address = root.address;
-      root = new_root;
+    while ((int) ret.size() < count) {
+      ret.push_back(sjtu::vector<T>());
     }
-  }
-
- private:
-  void init() {
-    tree.open(tree_name), data.open(data_name);
-    tree.seekg(0, std::ios::beg), data.seekg(0, std::ios::beg);
-    if (!tree || !data) {
-      tree.open(tree_name, std::ios::out), data.open(data_name, std::ios::out);
-      tree.write(reinterpret_cast<char *>(&tree_begin), sizeof(tree_begin));
-      data.write(reinterpret_cast<char *>(&data_begin), sizeof(data_begin));
-      root.address = tree_begin.start_place, root.son_num = 0, root.state = leaf;
-      tree.seekp(root.address);
-      tree.write(reinterpret_cast<char *>(&root), node_size);
-      tree.close(), data.close();
-      tree.open(tree_name), data.open(data_name);
-    } else {
-      tree.read(reinterpret_cast<char *>(&tree_begin), sizeof(tree_begin));
-      data.read(reinterpret_cast<char *>(&data_begin), sizeof(data_begin));
-      tree.seekg(tree_begin.start_place);
-      tree.read(reinterpret_cast<char *>(&root), sizeof(root));
-    }
-  }
-
-  bool InternalInsert(node &todo, const element &another) {
-    // false means its father ought to be modified
-    int pos = LowerBound(another, todo.index, 1, todo.son_num - 1);
-    if (todo.state == leaf) {
-      leaves todo_leaf;
-      ReadLeaf(todo_leaf, todo.son_pos[pos]);
-      int search = LowerBound(another, todo_leaf.storage, 1, todo_leaf.data_num);
-      for (int i = todo_leaf.data_num + 1; i > search; --i) {
-        todo_leaf.storage[i] = todo_leaf.storage[i - 1];
-      }
-      todo_leaf.storage[search] = another;
-      ++todo_leaf.data_num, todo_leaf.changed = true;
-      if (todo_leaf.data_num == max_size) {// block splitting
-        leaves new_block(false);
-        new_block.data_num = min_size, todo_leaf.data_num = min_size;
-        for (int i = 1; i <= min_size; ++i) {
-          new_block.storage[i] = todo_leaf.storage[i + min_size];
-        }
-        if (data_bin.empty()) {
-          new_block.address = data_begin.end_place, data_begin.end_place += leaf_size;
-        } else {
-          new_block.address = data_bin.pop_back();
-        }
-        new_block.next_pos = todo_leaf.next_pos, todo_leaf.next_pos = new_block.address;
-        data.seekp(new_block.address);
-        data.write(reinterpret_cast<char *>(&new_block), leaf_size);
-        WriteLeaves(todo_leaf), WriteLeaves(new_block);
-        // updating the node
-        ++todo.son_num;
-        element new_index = new_block.storage[1];
-        int new_pos = new_block.address;
-        for (int i = todo.son_num; i > pos + 1; --i) {
-          todo.son_pos[i] = todo.son_pos[i - 1];
-        }
-        for (int i = todo.son_num - 1; i > pos; --i) {
-          todo.index[i] = todo.index[i - 1];
-        }
-        todo.son_pos[pos + 1] = new_pos, todo.index[pos] = new_index;
-        todo.changed = true;
-        if (todo.son_num == max_son) { // going up
-          return false;
+    if (!count) {
+      return;
+    }
+    sjtu::vector<int> order;
+    for (int i = 0; i < count; ++i) {
+      order.push_back(i);
+    }
+    std::sort(&order[0], &order[0] + count, [&keys](int i, int j) { return keys[i] < keys[j]; });
+    batch_path path;
+    shared_leaf held;
+    element todo;
+    for (int i = 0; i < count; ++i) {
+      const Key &key = keys[order[i]];
+      sjtu::vector<T> &values = ret[order[i]];
+      if (i && !(keys[order[i - 1]] < key)) {
+        values = ret[order[i - 1]];
+        continue;
+      }
+      probe look(element(key, T()), false);
+      // everything before where the key before stopped is below key, so key starts on that leaf unless it is past it
+      const leaf_page *page = held ? &held->records : nullptr;
+      if (page && page->Count()) {
+        int last = page->Count() - 1;
+        if (data_begin.postings) {
+          KeyOf(page->Record(last), page->Size(last), todo.key);
         } else {
-          WriteNode(todo);
-          return true;
+          Decode(page->Record(last), page->Size(last), todo);
         }
-      } else {
-        WriteNode(todo);
-        WriteLeaves(todo_leaf);
-        return true;
       }
-    } else { // this is the node
-      node todo_node;
-      ReadNode(todo_node, todo.son_pos[pos]);
-      if (InternalInsert(todo_node, another)) {
-        WriteNode(todo);
-        return true;
-      } else { // needing to split
-        todo_node.changed = true;
-        node new_node(false);
-        new_node.son_num = todo_node.son_num = min_son;
-        for (int i = 1; i <= min_son; ++i) {
-          new_node.son_pos[i] = todo_node.son_pos[i + min_son];
+      if (!page || !page->Count() || todo.key < key) {
+        if (!BatchLeaf(path, look, data_begin.postings, held)) {
+          return;
         }
-        for (int i = 1; i < min_son; ++i) {
-          new_node.index[i] = todo_node.index[i + min_son];
-        }
-        new_node.state = todo_node.state;
-        if (tree_bin.empty()) {
-          new_node.address = tree_begin.end_place, tree_begin.end_place += node_size;
-        } else {
-          new_node.address = tree_bin.pop_back();
-        }
-        tree.seekp(new_node.address);
-        tree.write(reinterpret_cast<char *>(&new_node), node_size);
-        WriteNode(todo_node), WriteNode(new_node);
-        // updating todo
-        element new_index = todo_node.index[min_son];
-        int new_pos = new_node.address;
-        for (int i = todo.son_num + 1; i > pos + 1; --i) {
-          todo.son_pos[i] = todo.son_pos[i - 1];
+        page = &held->records;
+      }
+      int pos = data_begin.postings ? SearchKey(*page, look) : Search(*page, look, false);
+      if (data_begin.postings) {
+        if (pos < page->Count()) {
+          KeyOf(page->Record(pos), page->Size(pos), todo.key);
+          if (!(key < todo.key)) {
+            ForEachPosting(page->Record(pos), page->Size(pos), [&values](const T &now) { values.push_back(now); });
+          }
         }
-        for (int i = todo.son_num; i > pos; --i) {
-          todo.index[i] = todo.index[i - 1];
+        continue;
+      }
+      while (true) {
+        for (; pos < page->Count() && look.Matches(page->Record(pos), page->Size(pos), todo); ++pos) {
+          values.push_back(todo.value);
         }
-        todo.son_pos[pos + 1] = new_pos, todo.index[pos] = new_index;
-        ++todo.son_num, todo.changed = true;
-        if (todo.son_num == max_son) { // going up
-          return false;
-        } else {
-          WriteNode(todo);
-          return true;
+        if (pos < page->Count() || !held->next_pos) {
+          break;
         }
+        held = ReadShared(held->next_pos), pos = 0, page = &held->records;
       }
     }
   }
 
-  bool InternalErase(const element &another, node &todo) {
-    int pos = LowerBound(another, todo.index, 1, todo.son_num - 1);
-    if (todo.state == leaf) {
-      leaves todo_leaf;
-      ReadLeaf(todo_leaf, todo.son_pos[pos]);
-      int search = UpperBound(another, todo_leaf.storage, 1, todo_leaf.data_num);
-      if (!(another == todo_leaf.storage[search])) {
-        // not even deleting
-        WriteNode(todo);
-        WriteLeaves(todo_leaf);
-        return true;
-      }
-      for (int i = search; i < todo_leaf.data_num; ++i) {
-        todo_leaf.storage[i] = todo_leaf.storage[i + 1];
-      }
-      --todo_leaf.data_num, todo_leaf.changed = true;
-      if (todo_leaf.data_num < min_size) {
-        // std::cout << "adjusting" << '\n';
-        // leaf adjusting
-        todo.changed = true;
-        leaves before, after;
-        if (pos < todo.son_num) { // borrowing behind
-          ReadLeaf(after, todo.son_pos[pos + 1]);
-          if (after.data_num > min_size) { // can borrow
-            todo_leaf.storage[todo_leaf.data_num + 1] = after.storage[1];
-            ++todo_leaf.data_num;
-            for (int i = 1; i < after.data_num; ++i) {
-              after.storage[i] = after.storage[i + 1];
-            }
-            --after.data_num, after.changed = true;
-            todo.index[pos] = after.storage[1];
-            WriteNode(todo), WriteLeaves(todo_leaf), WriteLeaves(after);
-            return true;
-          }
-        }
-        if (pos > 1) { // borrowing front
-          ReadLeaf(before, todo.son_pos[pos - 1]);
-          if (before.data_num > min_size) {// can borrow
-            if (after.address) {
-              WriteLeaves(after);
-            }
-            for (int i = todo_leaf.data_num + 1; i > 1; --i) {
-              todo_leaf.storage[i] = todo_leaf.storage[i - 1];
-            }
-            ++todo_leaf.data_num, todo_leaf.storage[1] = before.storage[before.data_num];
-            --before.data_num, before.changed = true;
-            todo.index[pos - 1] = todo_leaf.storage[1];
-            WriteNode(todo), WriteLeaves(todo_leaf), WriteLeaves(before);
-            return true;
-          }
-        }
-        if (pos < todo.son_num) {
-          if (before.next_pos) {
-            WriteLeaves(before);
-          }
-          // merging the one behind
-          for (int i = 1; i <= after.data_num; ++i) {
-            todo_leaf.storage[todo_leaf.data_num + i] = after.storage[i];
+  /*
+   * @class cursor
+   * a position among the elements, in order of key and then value, reading
+   * them straight off the leaves: the leaf under it stays pinned, and next and
+   * prev follow next_pos and prev_pos, so walking a range either way descends
+   * from the root only once; on leaves lying one after another in the file, as
+   * BulkLoad leaves them, it reads the next run of them at once (see ReadAhead)
+   * with postings it goes through the values of a key a posting page at a time;
+   * backwards, as chains are linked one way, it takes all of them at once
+   * a cursor moved past either end is not valid; none survives an insert or an
+   * erase, which may free the leaf it is on
+   * when concurrent the leaf is latched shared as well, so writers to it wait
+   * until the cursor moves on or goes: a thread holding a cursor must make no
+   * other call on the tree, not even a find or a second cursor (see @latching)
+   */
+  class cursor {
+    friend class BPlusTree;
+    BPlusTree *tree = nullptr;
+    shared_leaf leaf; // empty once past an end
+    int pos = 0; // the record within leaf
+    element now;
+    // with postings, the values of the record now or of some pages of its chain, now.value being the at-th
+    sjtu::vector<T> values;
+    int at = 0, skipped = 0; // values of the record before those
+    long long next_chunk = 0; // the page of the chain after them, if any
+
+    explicit cursor(BPlusTree *tree_) : tree(tree_) {}
+    // goes on from record pos to the first there is, or the last backwards, and reads it
+    /*
+     * leaves being latched left to right, going back lets go of the leaf first,
+     * takes the one before it and then this one again: if this one did not change
+     * meanwhile, the one before is still the one before, otherwise the place of
+     * now is searched for again from the root
+     */
+    void settle(bool backwards) {
+      if (backwards) {
+        while (pos < 0) {
+          long long back = leaf->prev_pos, here = leaf->address;
+          if (!back) {
+            leaf.Release();
+            return;
           }
-          todo_leaf.data_num += after.data_num, todo_leaf.next_pos = after.next_pos;
-          WriteLeaves(todo_leaf), data_bin.push_back(after.address);
-          for (int i = pos + 1; i < todo.son_num; ++i) {
-            todo.son_pos[i] = todo.son_pos[i + 1];
+          unsigned seen = tree->LeafVersion(here);
+          leaf.Release();
+          if (back == here - 1 && here % partition_run == 0) {
+            tree->ReadAhead(back);
           }
-          for (int i = pos; i < todo.son_num - 1; ++i) {
-            todo.index[i] = todo.index[i + 1];
+          shared_leaf before = tree->ReadShared(back);
+          leaf = tree->ReadShared(here);
+          if (tree->LeafVersion(here) == seen) {
+            leaf = std::move(before), pos = leaf->records.Count() - 1;
+            continue;
           }
-          --todo.son_num;
-          if (todo.son_num < min_size) {
-            return false;
-          } else {
-            WriteNode(todo);
-            return true;
+          before.Release(), leaf.Release();
+          probe look(now, !tree->data_begin.postings);
+          if (!(leaf = tree->LeafOf(look, tree->data_begin.postings))) {
+            return;
           }
+          const leaf_page &page = leaf->records;
+          pos = (tree->data_begin.postings ? SearchKey(page, look) : Search(page, look, false)) - 1;
         }
-        if (pos > 1) {
-          if (after.next_pos) {
-            WriteLeaves(after);
-          }
-          // merging the one at front
-          for (int i = 1; i <= todo_leaf.data_num; ++i) {
-            before.storage[before.data_num + i] = todo_leaf.storage[i];
-          }
-          before.data_num += todo_leaf.data_num, before.next_pos = todo_leaf.next_pos;
-          before.changed = true;
-          WriteLeaves(before), data_bin.push_back(todo_leaf.address);
-          for (int i = pos; i < todo.son_num; ++i) {
-            todo.son_pos[i] = todo.son_pos[i + 1];
-          }
-          for (int i = pos - 1; i < todo.son_num - 1; ++i) {
-            todo.index[i] = todo.index[i + 1];
+      } else {
+        while (pos == leaf->records.Count()) {
+          if (!leaf->next_pos) {
+            leaf.Release();
+            return;
           }
-          --todo.son_num;
-          if (todo.son_num < min_size) {
-            return false;
-          } else {
-            WriteNode(todo);
-            return true;
+          long long next = leaf->next_pos;
+          if (next == leaf->address + 1 && next % partition_run == 0) {
+            tree->ReadAhead(next);
           }
+          leaf = tree->ReadShared(next), pos = 0;
         }
-        // only son, can't do anything
-        WriteNode(todo), WriteLeaves(todo_leaf);
-        return true;
-      } else {
-        // need no adjustment
-        WriteNode(todo), WriteLeaves(todo_leaf);
-        return true;
       }
-    } else {
-      node todo_node;
-      ReadNode(todo_node, todo.son_pos[pos]);
-      if (InternalErase(another, todo_node)) {
-        WriteNode(todo);
-        return true;
+      ReadRecord(backwards);
+    }
+    // reads the record at pos, at its last value if whole (with postings all of them are taken then)
+    void ReadRecord(bool whole) {
+      const char *record = leaf->records.Record(pos);
+      int size = leaf->records.Size(pos);
+      if (!tree->data_begin.postings) {
+        Decode(record, size, now);
+        return;
+      }
+      KeyOf(record, size, now.key);
+      values.clear(), skipped = 0;
+      int head = ListOf(record, size);
+      if (record[head] == inline_list) {
+        PostingCodec<T>::Decode(record + head + 1, size - head - 1 - posting_tail, [this](const T &one) {
+          values.push_back(one);
+        });
+        next_chunk = 0;
       } else {
-        todo_node.changed = true, todo.changed = true;
-        node before, after;
-        // node adjusting
-        if (pos < todo.son_num) { // borrowing behind
-          ReadNode(after, todo.son_pos[pos + 1]);
-          if (after.son_num > min_size) { // can borrow
-            todo_node.son_pos[todo_node.son_num + 1] = after.son_pos[1];
-            todo_node.index[todo_node.son_num] = todo.index[pos], todo.index[pos] = after.index[1];
-            ++todo_node.son_num;
-            for (int i = 1; i < after.son_num; ++i) {
-              after.son_pos[i] = after.son_pos[i + 1];
-            }
-            for (int i = 1; i < after.son_num - 1; ++i) {
-              after.index[i] = after.index[i + 1];
-            }
-            --after.son_num, after.changed = true;
-            WriteNode(todo), WriteNode(todo_node), WriteNode(after);
-            return true;
-          }
+        memcpy(&next_chunk, record + head + 1, sizeof(long long));
+        ReadChunks(whole);
+      }
+      at = whole ? (int) values.size() - 1 : 0, now.value = values[at];
+    }
+    // adds the values of page next_chunk of the chain, and if whole of the pages after it
+    void ReadChunks(bool whole) {
+      do {
+        posting_handle chunk = tree->ReadPostings(next_chunk);
+        PostingCodec<T>::Decode(chunk->bytes, chunk->size, [this](const T &one) { values.push_back(one); });
+        next_chunk = chunk->next_pos;
+      } while (whole && next_chunk);
+    }
+   public:
+    cursor() = default;
+
+    bool valid() const {
+      return (bool) leaf;
+    }
+    // the element under a valid cursor
+    const Key &key() const {
+      return now.key;
+    }
+    const T &value() const {
+      return now.value;
+    }
+    // moves on to the next element, if there is one
+    void next() {
+      if (tree->data_begin.postings) {
+        if (++at < (int) values.size()) {
+          now.value = values[at];
+          return;
         }
-        if (pos > 1) { // borrowing front
-          ReadNode(before, todo.son_pos[pos - 1]);
-          if (before.son_num > min_size) { // can borrow
-            if (after.address) {
-              WriteNode(after);
-            }
-            for (int i = todo_node.son_num + 1; i > 1; --i) {
-              todo_node.son_pos[i] = todo_node.son_pos[i - 1];
-            }
-            for (int i = todo_node.son_num; i > 1; --i) {
-              todo_node.index[i] = todo_node.index[i - 1];
-            }
-            todo_node.son_pos[1] = before.son_pos[before.son_num];
-            todo_node.index[1] = todo.index[pos - 1];
-            todo.index[pos - 1] = before.index[before.son_num - 1];
-            ++todo_node.son_num;
-            --before.son_num, before.changed = true;
-            WriteNode(todo), WriteNode(todo_node), WriteNode(before);
-            return true;
-          }
+        if (next_chunk) {
+          skipped += (int) values.size(), values.clear();
+          ReadChunks(false);
+          at = 0, now.value = values[0];
+          return;
         }
-        if (pos < todo.son_num) {
-          if (before.address) {
-            WriteNode(before);
-          }
-          // merging the one behind
-          for (int i = 1; i <= after.son_num; ++i) {
-            todo_node.son_pos[todo_node.son_num + i] = after.son_pos[i];
-          }
-          for (int i = 1; i < after.son_num; ++i) {
-            todo_node.index[todo_node.son_num + i] = after.index[i];
-          }
-          todo_node.index[todo_node.son_num] = todo.index[pos];
-          todo_node.son_num += after.son_num;
-          WriteNode(todo_node), tree_bin.push_back(after.address);
-          for (int i = pos + 1; i < todo.son_num; ++i) {
-            todo.son_pos[i] = todo.son_pos[i + 1];
-          }
-          for (int i = pos; i < todo.son_num - 1; ++i) {
-            todo.index[i] = todo.index[i + 1];
-          }
-          --todo.son_num;
-          if (todo.son_num < min_size) {
-            return false;
-          } else {
-            WriteNode(todo);
-            return true;
-          }
+      }
+      ++pos;
+      settle(false);
+    }
+    // moves back to the element before, if there is one
+    void prev() {
+      if (tree->data_begin.postings) {
+        if (at > 0) {
+          now.value = values[--at];
+          return;
         }
-        if (pos > 1) {
-          if (after.address) {
-            WriteNode(after);
-          }
-          // merging the one at front
-          for (int i = 1; i <= todo_node.son_num; ++i) {
-            before.son_pos[before.son_num + i] = todo_node.son_pos[i];
-          }
-          for (int i = 1; i < todo_node.son_num; ++i) {
-            before.index[before.son_num + i] = todo_node.index[i];
-          }
-          before.index[before.son_num] = todo.index[pos - 1];
-          before.son_num += todo_node.son_num;
-          WriteNode(before), tree_bin.push_back(todo_node.address);
-          for (int i = pos; i < todo.son_num; ++i) {
-            todo.son_pos[i] = todo.son_pos[i + 1];
-          }
-          for (int i = pos - 1; i < todo.son_num - 1; ++i) {
-            todo.index[i] = todo.index[i + 1];
-          }
-          --todo.son_num;
-          if (todo.son_num < min_size) {
-            return false;
-          } else {
-            WriteNode(todo);
-            return true;
-          }
+        if (skipped) { // the pages before these are read again
+          int back = skipped;
+          ReadRecord(true);
+          at = back - 1, now.value = values[at];
+          return;
         }
       }
+      --pos;
+      settle(true);
     }
-    WriteNode(todo);
-    return true;
+  };
+
+  // a cursor on the first element
+  cursor begin() {
+    cursor ret(this);
+    ret.leaf = Descend([](const node &) { return 1; });
+    if (ret.leaf) {
+      ret.settle(false);
+    }
+    return ret;
   }
-  void ReadNode(node &obj, int place) {
-    // std::cout << "node place: " << place << '\n';
-    if (!node_cache.GetNode(obj, place)) {
-      tree.seekg(place);
-      tree.read(reinterpret_cast<char *>(&obj), sizeof(obj));
-      // std::cout << "node_cache miss!\n";
-    } else {
-      // std::cout << "node_cache shot!\n";
+  // a cursor on the last element
+  cursor last() {
+    cursor ret(this);
+    if ((ret.leaf = Descend([](const node &todo) { return todo.right ? todo.Sons() + 1 : todo.Sons(); }))) {
+      ret.pos = ret.leaf->records.Count() - 1;
+      ret.settle(true);
     }
+    return ret;
   }
-  void ReadLeaf(leaves &obj, int place) {
-    // std::cout << "leaf place: " << place << '\n';
-    if (!leaf_cache.GetNode(obj, place)) {
-      data.seekg(place);
-      data.read(reinterpret_cast<char *>(&obj), sizeof(obj));
-      // std::cout << "leaf_cache miss!\n";
-    } else {
-      // std::cout << "leaf_cache shot!\n";
+  // a cursor on the first element whose key is not below key
+  cursor lower_bound(const Key &key) {
+    return CursorAt(key, false);
+  }
+  // a cursor on the first element whose key is above key
+  cursor upper_bound(const Key &key) {
+    return CursorAt(key, true);
+  }
+  // a cursor on the last element whose key is not above key
+  cursor floor(const Key &key) {
+    cursor ret = upper_bound(key);
+    if (!ret.valid()) {
+      return last();
+    }
+    ret.prev();
+    return ret;
+  }
+  // calls f(key, value) on every element with a key from lo to hi, both included, in order;
+  // f must not touch the tree, a cursor being held meanwhile
+  template<class F>
+  void scan(const Key &lo, const Key &hi, F f) {
+    for (cursor now = lower_bound(lo); now.valid() && !(hi < now.key()); now.next()) {
+      f(now.key(), now.value());
+    }
+  }
+  // the same from hi down to lo, so that the greatest come first, and with the same rule for f
+  template<class F>
+  void reverse_scan(const Key &lo, const Key &hi, F f) {
+    for (cursor now = floor(hi); now.valid() && !(now.key() < lo); now.prev()) {
+      f(now.key(), now.value());
+    }
+  }
+
+  void insert(const Key &key, const T &val) {
+    Write([this, &key, &val] { RootInsert(element(key, val), logged); });
+  }
+
+  void erase(const Key &key, const T &val) {
+    Write([this, &key, &val] { RootErase(element(key, val), logged); });
+  }
+
+  /*
+   * builds the tree from the elements next hands out, a bool(Key &, T &) giving
+   * false once they run out, sorted by key and then value: leaves are filled up
+   * to fill of their bytes one after another, and each level above takes its
+   * sons last as they come, so loading is one sequential pass of writes with no
+   * searches and no splits (fill is kept between a quarter and all of a page)
+   * an element out of order throws, those before it staying loaded
+   * a tree that is not empty gets the elements inserted one by one instead
+   * with a log the load is not logged but checkpointed as it goes and when it
+   * ends, so a crash keeps a first part of it
+   */
+  template<class F>
+  void BulkLoad(F next, double fill = 0.9) {
+    element now;
+    if (ReadNode(tree_begin.start_place)->Sons()) {
+      while (next(now.key, now.value)) {
+        insert(now.key, now.value);
+      }
+      return;
+    }
+    fill = std::min(std::max(fill, 0.25), 1.0);
+    load_state state;
+    state.leaf_most = (int) (fill * leaf_capacity), state.node_most = (int) (fill * node_capacity);
+    state.posting_most = (int) (fill * posting_capacity);
+    char record[max_record];
+    element last;
+    sjtu::vector<T> values; // with postings, those of the key of last
+    bool any = false;
+    while (next(now.key, now.value)) {
+      if (any && now < last) {
+        throw sjtu::runtime_error();
+      }
+      if (!data_begin.postings) {
+        LoadRecord(state, record, Encode(now, record));
+      } else if (any && last.key < now.key) {
+        LoadRecord(state, record, ListRecord(last.key, values, state, record));
+        values.clear();
+      }
+      if (data_begin.postings) {
+        values.push_back(now.value);
+      }
+      last = now, any = true;
+    }
+    if (data_begin.postings && any) {
+      LoadRecord(state, record, ListRecord(last.key, values, state, record));
+    }
+    if (any) {
+      FinishLoad(state);
+    }
+    if (logged) {
+      Checkpoint();
     }
   }
-  void WriteNode(node &obj) {
-    if (obj.address == 8) {// do not write root!
+  /*
+   * the same for elements in any order: they are sorted first, in runs of
+   * run_bytes put aside in a file next to the tree and merged (see ExternalSort.hpp)
+   */
+  template<class F>
+  void BulkLoadUnsorted(F next, double fill = 0.9, long long run_bytes = default_budget) {
+    ExternalSort<element> sorted(tree_name, run_bytes);
+    element now;
+    while (next(now.key, now.value)) {
+      sorted.Add(now);
+    }
+    BulkLoad([&sorted, &now](Key &key, T &value) {
+      if (!sorted.Next(now)) {
+        return false;
+      }
+      key = now.key, value = now.value;
+      return true;
+    }, fill);
+  }
+
+ private:
+  /*
+   * the latches a writer holds: nodes exclusive, from the top down, or a single
+   * one shared, then leaves (see @latching); whatever is left is let go of when it goes
+   */
+  struct latch_path {
+    BPlusTree *tree;
+    sjtu::vector<long long> nodes, leaves;
+    long long shared = 0; // the node latched shared, if any
+    bool logging = false; // the operation is logged once its leaf is latched
+
+    explicit latch_path(BPlusTree *tree_) : tree(tree_) {}
+    ~latch_path() {
+      tree->ReleaseLeaves(*this), tree->ReleaseNodes(*this);
+    }
+  };
+
+  void RootInsert(const element &another, bool logging) {
+    char record[max_record + sizeof(long long)];
+    // a record too long throws before anything is latched or logged
+    int size = data_begin.postings ? PostingRecord(another, record) : Encode(another, record);
+    probe look(another, !data_begin.postings);
+    // with the father shared while the leaf has room for any record, alone otherwise
+    for (bool alone = !concurrent;; alone = true) {
+      latch_path path(this);
+      path.logging = logging;
+      node_handle father = LatchCovering(path, look, 1, alone);
+      if (father->Sons() == 0) { // nothing exist, first insert
+        if (!alone) {
+          continue;
+        }
+        if (logging) {
+          Log(log_insert, another);
+        }
+        leaf_handle first_leaf = CreateLeaf(data_begin.start_place);
+        if (data_begin.start_place == data_begin.end_place) {
+          ++data_begin.end_place;
+        }
+        first_leaf->records.Append(record, size);
+        father->first_son = first_leaf->address;
+        father.Dirty();
+        return;
+      }
+      int pos = SonOf(*father, look);
+      leaf_handle todo_leaf = ReadLeaf(father->Son(pos));
+      LatchLeaf(path, father->Son(pos));
+      if (!alone && !SafeLeaf(*todo_leaf, true)) {
+        continue;
+      }
+      split_info up;
+      if (LeafInsert(father, pos, todo_leaf, look, up, path)) {
+        int level = father->level + 1;
+        todo_leaf.Release(), father.Release();
+        ReleaseLeaves(path), ReleaseNodes(path);
+        InsertAbove(up, level);
+      }
+      return;
+    }
+  }
+
+  void RootErase(const element &another, bool logging) {
+    probe look(another, !data_begin.postings);
+    for (bool alone = !concurrent;; alone = true) {
+      latch_path path(this);
+      path.logging = logging;
+      node_handle father = LatchCovering(path, look, 1, alone);
+      if (father->Sons() == 0) { // nothing to erase
+        return;
+      }
+      int pos = SonOf(*father, look);
+      leaf_handle todo_leaf = ReadLeaf(father->Son(pos));
+      LatchLeaf(path, father->Son(pos));
+      if (!alone && !SafeLeaf(*todo_leaf, false)) {
+        continue;
+      }
+      if (LeafErase(father, pos, todo_leaf, look, path) && father->address != tree_begin.start_place) {
+        todo_leaf.Release(), father.Release();
+        ReleaseLeaves(path), ReleaseNodes(path);
+        Rebalance(look, 2);
+      }
+      return;
+    }
+  }
+  // lowering the tree when the root is left with a single son node; nothing but the root may be latched
+  void LowerRoot(node_handle &root, latch_path &path) {
+    if (root->level == 1 || root->Sons() != 1) {
+      return;
+    }
+    long long root_address = root->address, old_address = root->first_son;
+    node_handle new_root = ReadNode(old_address);
+    LatchNode(path, old_address);
+    if (new_root->right) { // its split is not finished yet
+      return;
+    }
+    *root = *new_root;
+    root->address = root_address;
+    root.Dirty();
+    new_root.Release();
+    FreeNode(path, old_address);
+  }
+
+  /*
+   * @bulk loading
+   * the tree is built along its right edge: spine holds the last node of every
+   * level, from the fathers of leaves up to the root, and a full one is followed
+   * by a new node, which goes into the level above; the root keeps its address
+   * by moving its sons out when full, like a split, so the tree is whole after
+   * every record, which is what lets checkpoints in between
+   */
+  struct load_state {
+    sjtu::vector<long long> spine;
+    leaf_handle leaf; // the last leaf
+    int leaf_most, node_most, posting_most; // bytes a page is filled to
+    std::string list; // encoded values of a posting record
+  };
+  // puts record last into the tree
+  void LoadRecord(load_state &state, const char *record, int size) {
+    if (!state.leaf) { // the first one, after the posting pages of its record if any
+      state.leaf = NewLeaf();
+      data_begin.start_place = state.leaf->address;
+      state.leaf->records.Append(record, size);
+      node_handle root = ReadNode(tree_begin.start_place);
+      root->first_son = state.leaf->address, root.Dirty();
+      state.spine.push_back(tree_begin.start_place);
+      return;
+    }
+    leaf_page &page = state.leaf->records;
+    state.leaf.Dirty();
+    if (page.Used() + size + leaf_page::slot_size <= state.leaf_most && page.Append(record, size)) {
+      return;
+    }
+    char separator[max_record];
+    int separator_size = SeparateLeaves(page.Record(page.Count() - 1), page.Size(page.Count() - 1),
+                                        record, size, separator);
+    leaf_handle fresh = NewLeaf();
+    long long address = fresh->address;
+    fresh->records.Append(record, size);
+    state.leaf->next_pos = address, fresh->prev_pos = state.leaf->address;
+    state.leaf = std::move(fresh);
+    LoadSon(state, 0, address, separator, separator_size);
+    if (logged) { // nothing may be pinned through a checkpoint
+      state.leaf.Release();
+      CheckpointIfDue();
+      state.leaf = ReadLeaf(address);
+    }
+  }
+  // puts son, separator in front of it, last into the level-th node of the spine
+  void LoadSon(load_state &state, int level, long long son, const char *separator, int size) {
+    char record[max_record + sizeof(long long)];
+    int record_size = SonRecord(son, separator, size, record);
+    node_handle todo = ReadNode(state.spine[level]);
+    todo.Dirty();
+    auto fits = [&todo, record_size, &state] {
+      return todo->records.Used() + record_size - todo->prefix_size + node_page::slot_size <= state.node_most;
+    };
+    if (!fits() && prefix_limit) { // the separators so far packed, with what they have in common cut off
+      wide_records all;
+      all.Add(*todo, 0, todo->records.Count());
+      Pack(*todo, todo->first_son, all, 0, all.Count());
+    }
+    if ((fits() || !todo->records.Count()) && InsertSon(*todo, todo->records.Count(), record, record_size)) {
       return;
     }
-    node_cache.InsertFront(obj);
+    long long address = todo->address;
+    if (level + 1 == (int) state.spine.size()) { // the root is full: its sons move out
+      node_handle moved = NewNode();
+      long long moved_address = moved->address;
+      *moved = *todo;
+      moved->address = moved_address;
+      todo->level = level + 2, todo->first_son = moved_address, todo->prefix_size = 0;
+      todo->records.Clear();
+      state.spine[level] = moved_address;
+      state.spine.push_back(address);
+    }
+    todo.Release();
+    node_handle fresh = NewNode(), last = ReadNode(state.spine[level]);
+    fresh->level = level + 1, fresh->first_son = son;
+    SetRight(*last, fresh->address, separator, size), last.Dirty();
+    state.spine[level] = fresh->address;
+    fresh.Release(), last.Release();
+    LoadSon(state, level + 1, state.spine[level], separator, size);
+  }
+  /*
+   * the right edge may end short of records: the last leaf and the last node of
+   * every level are merged with, or fed by, the one before, as after an erase
+   */
+  void FinishLoad(load_state &state) {
+    latch_path path(this);
+    for (int level = 0; level < (int) state.spine.size(); ++level) {
+      node_handle todo = ReadNode(state.spine[level]);
+      int sons = todo->Sons();
+      if (sons < 2) {
+        continue;
+      }
+      if (level == 0) {
+        leaf_handle before = ReadLeaf(todo->Son(sons - 1));
+        if (state.leaf->records.Used() < leaf_underflow) {
+          AdjustLeaves(todo, sons - 1, before, state.leaf, path);
+        }
+        continue;
+      }
+      node_handle after = ReadNode(todo->Son(sons));
+      if (after->records.Used() < node_underflow) {
+        node_handle before = ReadNode(todo->Son(sons - 1));
+        AdjustNodes(todo, sons - 1, before, after, path);
+      }
+    }
+    state.leaf.Release();
+    node_handle root = ReadNode(tree_begin.start_place);
+    LowerRoot(root, path);
   }
-  void WriteLeaves(leaves &obj) {
-    leaf_cache.InsertFront(obj);
+  /*
+   * the posting record of key with values, which are sorted: inline if they
+   * fit, otherwise on a chain of posting pages filled to posting_most bytes
+   */
+  int ListRecord(const Key &key, const sjtu::vector<T> &values, load_state &state, char *record) {
+    int head = PostingHead(key, record), count = (int) values.size(), max_size = PostingCodec<T>::MaxSize();
+    std::string &list = state.list;
+    if (head + 1 + count + posting_tail <= max_record) { // every value takes a byte at least
+      list.resize((size_t) count * max_size);
+      int size = PostingCodec<T>::Encode(values, 0, count, &list[0]);
+      if (head + 1 + size + posting_tail <= max_record) {
+        record[head] = inline_list;
+        memcpy(record + head + 1, list.data(), size);
+        return PostingTail(record, head, head + 1 + size);
+      }
+    }
+    posting_handle chunk;
+    for (int begin = 0; begin < count;) {
+      // as many values as posting_most bytes hold, found by halving
+      int l = std::min(count - begin, std::max(1, state.posting_most / max_size));
+      int r = std::min(count - begin, state.posting_most);
+      list.resize((size_t) r * max_size);
+      while (l < r) {
+        int mid = (l + r + 1) >> 1;
+        if (PostingCodec<T>::Encode(values, begin, begin + mid, &list[0]) <= state.posting_most) {
+          l = mid;
+        } else {
+          r = mid - 1;
+        }
+      }
+      posting_handle fresh = NewPostings();
+      fresh->size = PostingCodec<T>::Encode(values, begin, begin + l, fresh->bytes);
+      if (chunk) {
+        chunk->next_pos = fresh->address;
+      } else {
+        record[head] = overflow_list;
+        memcpy(record + head + 1, &fresh->address, sizeof(long long));
+      }
+      chunk = std::move(fresh);
+      begin += l;
+    }
+    return PostingTail(record, head, head + 1 + (int) sizeof(long long));
+  }
+
+  void init() {
+    bool exist;
+    if (mapped) {
+      bool tree_exist = tree_map.Open(tree_name), data_exist = data_map.Open(data_name);
+      exist = tree_exist && data_exist;
+    } else {
+      bool tree_exist = tree.Open(tree_name, direct), data_exist = data.Open(data_name, direct);
+      exist = tree_exist && data_exist;
+    }
+    if (logged) {
+      log.Attach(tree), log.Attach(data);
+      tree_bin_file = log.Attach(tree_bin.File()), data_bin_file = log.Attach(data_bin.File());
+      if (log.Open(log_name)) { // a checkpoint was cut short and has been redone
+        tree_bin.Load(), data_bin.Load();
+      }
+      cache.HoldDirty(true);
+    }
+    if (!exist) {
+      WriteTreeBlock(0, &tree_begin, sizeof(tree_begin));
+      WriteDataBlock(0, &data_begin, sizeof(data_begin));
+      CreateNode(tree_begin.start_place);
+    } else {
+      ReadTreeBlock(0, &tree_begin, sizeof(tree_begin));
+      ReadDataBlock(0, &data_begin, sizeof(data_begin));
+      if (tree_begin.page_bytes != page_size) {
+        throw sjtu::runtime_error();
+      }
+    }
+    if (logged) {
+      // the files hold the last checkpoint: redo what came after it
+      log.Replay(tree_begin.log_lsn, [this, exist](char op, const char *payload, int size) {
+        element todo;
+        if (!exist) { // a log left over from other files
+          return;
+        }
+        Decode(payload, size, todo);
+        if (op == log_insert) {
+          RootInsert(todo, false);
+        } else {
+          RootErase(todo, false);
+        }
+      });
+      Checkpoint();
+    }
+  }
+
+  void Log(LogOp op, const element &todo) {
+    char record[max_record];
+    int size = Encode(todo, record);
+    log.Append((char) op, record, size);
+    logged_bytes += size;
+  }
+
+  bool CheckpointDue() const {
+    return cache.DirtyBytes() > checkpoint_bytes || logged_bytes > log_limit
+        || (checkpoint_ms && std::chrono::steady_clock::now() >= next_checkpoint);
+  }
+  void CheckpointIfDue() {
+    if (CheckpointDue()) {
+      TakeCheckpoint();
+    }
+  }
+  // Checkpoint, with whatever gate asks taken care of
+  void TakeCheckpoint() {
+    if (mapped) {
+      return;
+    }
+    if (logged) {
+      tree_begin.log_lsn = log.Last();
+      // the log attached the files in the cache's order, so file indices agree
+      cache.ForEachDirty([this](int file, long long page, const char *obj, int size) {
+        log.Stage(file, page * size, obj, size);
+      });
+      log.Stage(tree_file, 0, &tree_begin, sizeof(tree_begin));
+      log.Stage(data_file, 0, &data_begin, sizeof(data_begin));
+      log.Stage(tree_bin_file, 0, &tree_bin.Image(), sizeof(before));
+      log.Stage(data_bin_file, 0, &data_bin.Image(), sizeof(before));
+      log.Seal();
+    }
+    // with a log no writer is in the middle of anything: pinned blocks go as well
+    cache.Flush(logged);
+    {
+      std::lock_guard<std::mutex> guard(alloc_latch);
+      UpdateTree(), UpdateData();
+      tree_bin.Save(), data_bin.Save();
+    }
+    if (logged) {
+      log.Finish();
+      logged_bytes = 0;
+      next_checkpoint = std::chrono::steady_clock::now() + std::chrono::milliseconds(checkpoint_ms);
+    }
+  }
+
+  /*
+   * runs write, an insert or an erase; with a log it holds gate shared (when
+   * concurrent) and is followed by a checkpoint once one is due
+   */
+  template<class F>
+  void Write(F write) {
+    if (!logged) {
+      write();
+      return;
+    }
+    std::shared_lock<std::shared_mutex> shared(gate, std::defer_lock);
+    if (concurrent) {
+      shared.lock();
+    }
+    write();
+    bool due = CheckpointDue();
+    if (!due) {
+      return;
+    }
+    std::unique_lock<std::shared_mutex> alone(gate, std::defer_lock);
+    if (concurrent) {
+      shared.unlock(), alone.lock();
+      due = CheckpointDue();
+    }
+    if (due) {
+      TakeCheckpoint();
+    }
+  }
+
+  /*
+   * @supplementary functions
+   * encoding elements into records, and locating them inside a page
+   */
+  static int Encode(const element &todo, char *to) {
+    int size = KeyTraits<Key>::Size(todo.key);
+    if (size + (int) sizeof(T) > max_record) {
+      throw sjtu::runtime_error();
+    }
+    KeyTraits<Key>::Encode(todo.key, to);
+    KeyTraits<T>::Encode(todo.value, to + size);
+    return size + (int) sizeof(T);
+  }
+  static void Decode(const char *from, int size, element &to) {
+    KeyTraits<Key>::Decode(from, size - (int) sizeof(T), to.key);
+    KeyTraits<T>::Decode(from + size - sizeof(T), sizeof(T), to.value);
+  }
+  /*
+   * what a search compares records with: an element, or only its key when not
+   * whole, encoded once up front when comparisons are bytewise
+   * Before tells whether a record (or separator) goes before it, or with
+   * or_equal, whether it is not after it
+   */
+  struct probe {
+    element target;
+    bool whole;
+    int size = 0;
+    char bytes[max_record];
+
+    // a separator, in full
+    probe(const char *separator, int separator_size) : whole(true) {
+      if (bytewise) {
+        memcpy(bytes, separator, size = separator_size);
+      }
+      if (!bytewise || whole_separators) { // cut short only when compared bytewise
+        Decode(separator, separator_size, target);
+      }
+    }
+    probe(const element &target_, bool whole_) : target(target_), whole(whole_) {
+      if (!bytewise) {
+        return;
+      }
+      if (whole) {
+        size = Encode(target, bytes);
+        return;
+      }
+      if ((size = KeyTraits<Key>::Size(target.key)) > max_record) {
+        throw sjtu::runtime_error();
+      }
+      KeyTraits<Key>::Encode(target.key, bytes);
+    }
+    // the record against the encoded target from byte skip on; a record cut short of it goes before it
+    bool Before(const char *record, int record_size, bool or_equal, int skip = 0) const {
+      int ret = memcmp(record, bytes + skip, std::min(record_size, size - skip));
+      if (ret) {
+        return ret < 0;
+      }
+      if (record_size < size - skip) {
+        return true;
+      }
+      // the record starts with the target: with only a key, the key of the record is it
+      return or_equal && (!whole || record_size == size - skip);
+    }
+    bool Before(const element &now, bool or_equal) const {
+      if (whole) {
+        return or_equal ? !(target < now) : now < target;
+      }
+      return or_equal ? !(target.key < now.key) : now.key < target.key;
+    }
+    // whether the record holds the key looked for (not whole), the value going to now if so
+    bool Matches(const char *record, int record_size, element &now) const {
+      if (!bytewise) {
+        Decode(record, record_size, now);
+        return now.key == target.key;
+      }
+      if (record_size - (int) sizeof(T) != size || memcmp(record, bytes, size)) {
+        return false;
+      }
+      KeyTraits<T>::Decode(record + size, sizeof(T), now.value);
+      return true;
+    }
+  };
+
+  // a node record: the son, then its separator
+  static int SonRecord(long long son, const char *separator, int size, char *to) {
+    memmove(to + sizeof(long long), separator, size);
+    memcpy(to, &son, sizeof(long long));
+    return size + (int) sizeof(long long);
+  }
+
+  /*
+   * the first of count sorted records for which goes_before_at(i) is false (it is
+   * true for a prefix of them); goes_before_at must agree with the order of keys
+   * around key: true for records with a smaller key, false for a greater one
+   * integral keys, read from the key column of a node, settle everything but
+   * the records equal to key (see CountKeys); the rest is plain halving, which
+   * is all there is for pages without a column
+   */
+  template<class F>
+  static int Locate(int count, const Key &key, const char *column, F goes_before_at) {
+    int l = 0, r = count;
+    if constexpr (std::is_integral<Key>::value) {
+      if (column) {
+        l = r = CountKeys(column, count, key, false);
+        if (l < count && ColumnAt(column, l) == SearchOrder(key)) {
+          r = CountKeys(column, count, key, true);
+        }
+      }
+    }
+    while (l < r) {
+      int mid = (l + r) >> 1;
+      if (goes_before_at(mid)) {
+        l = mid + 1;
+      } else {
+        r = mid;
+      }
+    }
+    return l;
+  }
+  static long long ColumnAt(const char *column, int i) {
+    long long ret;
+    memcpy(&ret, column + i * sizeof(long long), sizeof(long long));
+    return ret;
+  }
+  /*
+   * how many of the count keys of a column are below key (not above it, with
+   * or_equal); a page holds few enough of them that counting every one with
+   * vector compares, streaming through the column, beats probing it by halves
+   */
+  static int CountKeys(const char *column, int count, const Key &key, bool or_equal) {
+    long long target = SearchOrder(key);
+    if (or_equal) {
+      if (target == LLONG_MAX) {
+        return count;
+      }
+      ++target;
+    }
+    return CountLess(column, count, target);
+  }
+
+  // Locate over the elements of a leaf
+  static int Search(const leaf_page &page, const probe &look, bool or_equal) {
+    if (bytewise) {
+      return Locate(page.Count(), look.target.key, nullptr, [&page, &look, or_equal](int i) {
+        return look.Before(page.Record(i), page.Size(i), or_equal);
+      });
+    }
+    element now;
+    return Locate(page.Count(), look.target.key, nullptr, [&page, &look, or_equal, &now](int i) {
+      Decode(page.Record(i), page.Size(i), now);
+      return look.Before(now, or_equal);
+    });
+  }
+  // the same over the separators of a node, the prefix written once in front of each
+  static int SearchNode(const node &todo, const probe &look, bool or_equal) {
+    int count = todo.records.Count();
+    if (bytewise) {
+      // the prefix is compared once; if it differs from the target, so do all the separators
+      int common = std::min(todo.prefix_size, look.size);
+      if (memcmp(todo.prefix, look.bytes, common) || common < todo.prefix_size) {
+        return look.Before(todo.prefix, todo.prefix_size, or_equal) ? count : 0;
+      }
+      return Locate(count, look.target.key, todo.records.Keys(), [&todo, &look, or_equal](int i) {
+        return look.Before(todo.records.Record(i) + sizeof(long long),
+                           todo.records.Size(i) - (int) sizeof(long long), or_equal, todo.prefix_size);
+      });
+    }
+    char separator[max_record];
+    memcpy(separator, todo.prefix, todo.prefix_size);
+    element now;
+    return Locate(count, look.target.key, todo.records.Keys(), [&todo, &separator, &now, &look, or_equal](int i) {
+      int size = todo.records.Size(i) - (int) sizeof(long long);
+      memcpy(separator + todo.prefix_size, todo.records.Record(i) + sizeof(long long), size);
+      Decode(separator, todo.prefix_size + size, now);
+      return look.Before(now, or_equal);
+    });
+  }
+  /*
+   * the son of todo the target of look belongs to: after every separator not
+   * above it (with postings all values of a key share a record, and look holds
+   * only the key)
+   */
+  static int SonOf(const node &todo, const probe &look) {
+    return SearchNode(todo, look, true) + 1;
+  }
+  /*
+   * the son of todo a search for look goes to, SearchNode picking it with
+   * or_equal, or Sons() + 1 for the node to the right when look is past the
+   * high key (see @latching)
+   */
+  static int SonOrRight(const node &todo, const probe &look, bool or_equal) {
+    if (todo.right) {
+      bool past;
+      if (bytewise) {
+        past = look.Before(todo.high, todo.high_size, or_equal);
+      } else {
+        element high;
+        Decode(todo.high, todo.high_size, high);
+        past = look.Before(high, or_equal);
+      }
+      if (past) {
+        return todo.Sons() + 1;
+      }
+    }
+    return SearchNode(todo, look, or_equal) + 1;
+  }
+  // the leaf a search for look ends in, SearchNode picking the sons with or_equal; empty if the tree is
+  shared_leaf LeafOf(const probe &look, bool or_equal) {
+    return Descend([&look, or_equal](const node &todo) { return SonOrRight(todo, look, or_equal); });
+  }
+  /*
+   * the node a walk from the root ends in, going to son pick(node), or to the
+   * right for Sons() + 1, until a son of a node at level is picked, pos being
+   * that son; the root if it is below level or empty (pos 0)
+   */
+  template<class F>
+  node_handle Walk(F pick, int level, int &pos) {
+    node_handle hold = ReadNode(tree_begin.start_place);
+    pos = 0;
+    while (hold->Sons() && ((pos = pick(*hold)) > hold->Sons() || hold->level > level)) {
+      hold = ReadNode(pos > hold->Sons() ? hold->right : hold->Son(pos));
+    }
+    return hold;
+  }
+  /*
+   * Walk when concurrent, latching nothing: pick only ever sees copies a writer
+   * did not touch while they were made, and the son (or right node) it picks
+   * is one still if the node it came from has the same version after the son's
+   * was taken; now ends as the copy of the last node, at page, version being
+   * its version; false if a writer got in the way
+   */
+  template<class F>
+  bool WalkOptimistic(F pick, int level, node &now, long long &page, unsigned &version, int &pos) {
+    page = tree_begin.start_place, pos = 0;
+    if (!ReadOptimistic(page, now, version)) {
+      return false;
+    }
+    while (now.Sons() && ((pos = pick(now)) > now.Sons() || now.level > level)) {
+      long long next = pos > now.Sons() ? now.right : now.Son(pos);
+      unsigned next_version;
+      if (!ReadOptimistic(next, now, next_version) || !node_latches.Validate(page, version)) {
+        return false;
+      }
+      page = next, version = next_version;
+    }
+    return true;
+  }
+  /*
+   * the walk of the last search of a batch, from the root down: the node of
+   * every step and the son (or, past Sons(), the node to the right) it picked;
+   * with concurrent on, copies of the nodes and their versions, as in
+   * WalkOptimistic
+   */
+  struct batch_step {
+    long long page;
+    unsigned version;
+    int pick;
+    node_handle hold; // when not concurrent
+  };
+  struct batch_path {
+    batch_step *steps = nullptr;
+    node *copies = nullptr;
+    int depth = 0, capacity = 0;
+
+    ~batch_path() {
+      delete[] steps;
+      delete[] copies;
+    }
+  };
+  const node &StepNode(const batch_path &path, int d) const {
+    return concurrent ? path.copies[d] : *path.steps[d].hold;
+  }
+  // reads the node at page as step d of path; false if a writer got in the way
+  bool ReadStep(batch_path &path, int d, long long page) {
+    if (d == path.capacity) {
+      path.capacity = path.capacity ? 2 * path.capacity : 8;
+      auto *steps = new batch_step[path.capacity];
+      for (int i = 0; i < d; ++i) {
+        steps[i].page = path.steps[i].page, steps[i].version = path.steps[i].version;
+        steps[i].pick = path.steps[i].pick, steps[i].hold = std::move(path.steps[i].hold);
+      }
+      delete[] path.steps;
+      path.steps = steps;
+      if (concurrent) {
+        node *copies = new node[path.capacity];
+        for (int i = 0; i < d; ++i) {
+          copies[i].CopyFrom(path.copies[i]);
+        }
+        delete[] path.copies;
+        path.copies = copies;
+      }
+    }
+    batch_step &now = path.steps[d];
+    now.page = page;
+    if (!concurrent) {
+      now.hold = ReadNode(page);
+      return true;
+    }
+    return ReadOptimistic(page, path.copies[d], now.version);
+  }
+  /*
+   * the leaf a search for look ends in, as LeafOf finds it, into held, latched
+   * shared, unless held is that leaf already; the walk goes down again only
+   * from the first step of path it parts with; false if the tree is empty
+   */
+  bool BatchLeaf(batch_path &path, const probe &look, bool or_equal, shared_leaf &held) {
+    auto pick = [&look, or_equal](const node &todo) { return SonOrRight(todo, look, or_equal); };
+    for (;; path.depth = 0) { // from the root again whenever a writer got in the way
+      if (concurrent) { // nodes may wait for writers, which may wait for the leaf (see @latching)
+        held.Release();
+      }
+      if (!path.depth) {
+        if (!ReadStep(path, 0, tree_begin.start_place)) {
+          continue;
+        }
+        path.depth = 1, path.steps[0].pick = 0;
+      }
+      if (!StepNode(path, 0).Sons()) {
+        held.Release();
+        return false;
+      }
+      int d = 0, pos = pick(StepNode(path, 0));
+      while (d + 1 < path.depth && pos == path.steps[d].pick) {
+        pos = pick(StepNode(path, ++d));
+      }
+      bool moved = false;
+      while (true) {
+        const node &now = StepNode(path, d);
+        path.steps[d].pick = pos, path.depth = d + 1;
+        if (pos <= now.Sons() && now.level == 1) {
+          break;
+        }
+        long long next = pos > now.Sons() ? now.right : now.Son(pos);
+        if (!ReadStep(path, d + 1, next)
+            || (concurrent && !node_latches.Validate(path.steps[d].page, path.steps[d].version))) {
+          moved = true;
+          break;
+        }
+        pos = pick(StepNode(path, ++d));
+      }
+      if (moved) {
+        continue;
+      }
+      long long page = StepNode(path, d).Son(pos);
+      if (!held || held->address != page) {
+        held.Release();
+        held = ReadShared(page);
+      }
+      if (!concurrent || node_latches.Validate(path.steps[d].page, path.steps[d].version)) {
+        return true;
+      }
+    }
+  }
+  // the leaf the same walk ends in, latched shared
+  template<class F>
+  shared_leaf Descend(F pick) {
+    int pos;
+    if (!concurrent) {
+      node_handle hold = Walk(pick, 1, pos);
+      return hold->Sons() ? ReadShared(hold->Son(pos)) : shared_leaf();
+    }
+    node now;
+    long long page;
+    unsigned version;
+    for (;;) { // from the root again whenever a writer got in the way
+      if (!WalkOptimistic(pick, 1, now, page, version, pos)) {
+        continue;
+      }
+      if (!now.Sons()) {
+        return shared_leaf();
+      }
+      shared_leaf ret = ReadShared(now.Son(pos));
+      if (node_latches.Validate(page, version)) {
+        return ret;
+      }
+    }
+  }
+  /*
+   * the node at level where look belongs, from the root down and to the right,
+   * latched (exclusive or shared) on path: its version is checked once it is,
+   * the node having to be the one the walk saw; the root if it is below level
+   */
+  node_handle LatchCovering(latch_path &path, const probe &look, int level, bool exclusive) {
+    auto pick = [&look](const node &todo) { return SonOrRight(todo, look, true); };
+    int pos;
+    if (!concurrent) {
+      return Walk(pick, level, pos);
+    }
+    node now;
+    long long page;
+    unsigned version;
+    for (;;) {
+      if (!WalkOptimistic(pick, level, now, page, version, pos)) {
+        continue;
+      }
+      node_handle ret = ReadNode(page);
+      if (exclusive) {
+        node_latches.Lock(page);
+      } else {
+        node_latches.LockShared(page);
+      }
+      if (node_latches.Version(page) == version) {
+        if (exclusive) {
+          path.nodes.push_back(page);
+        } else {
+          path.shared = page;
+        }
+        return ret;
+      }
+      if (exclusive) {
+        node_latches.Unlock(page);
+      } else {
+        node_latches.UnlockShared(page);
+      }
+    }
+  }
+  // a cursor on the first element whose key is above key, with upper, or not below it otherwise
+  cursor CursorAt(const Key &key, bool upper) {
+    cursor ret(this);
+    probe look(element(key, T()), false);
+    if (!(ret.leaf = LeafOf(look, upper || data_begin.postings))) {
+      return ret;
+    }
+    const leaf_page &page = ret.leaf->records;
+    if (!data_begin.postings) {
+      ret.pos = Search(page, look, upper);
+    } else if ((ret.pos = SearchKey(page, look)) < page.Count() && upper) {
+      Key found;
+      KeyOf(page.Record(ret.pos), page.Size(ret.pos), found);
+      ret.pos += !(key < found);
+    }
+    ret.settle(false);
+    return ret;
+  }
+
+  /*
+   * a separator for two neighbouring leaf records, writing it to to: greater
+   * than last and not greater than first
+   * if the encoding orders keys, a key of first cut short will do, as long as
+   * it stays above the key of last; compared bytewise, it needs no value either
+   */
+  static int Separate(const char *last, int last_size, const char *first, int first_size, char *to) {
+    int size = first_size;
+    if (KeyTraits<Key>::ordered && !whole_separators) {
+      int last_key = last_size - (int) sizeof(T), first_key = first_size - (int) sizeof(T), same = 0;
+      while (same < last_key && same < first_key && last[same] == first[same]) {
+        ++same;
+      }
+      if (same < first_key && (same == last_key || (unsigned char) last[same] < (unsigned char) first[same])) {
+        memcpy(to, first, same + 1);
+        if (bytewise) {
+          return same + 1;
+        }
+        memcpy(to + same + 1, first + first_key, sizeof(T));
+        return same + 1 + (int) sizeof(T);
+      }
+    }
+    memmove(to, first, size);
+    return size;
+  }
+  // the same for any two leaf records, posting records being taken as elements
+  int SeparateLeaves(const char *last, int last_size, const char *first, int first_size, char *to) const {
+    if (!data_begin.postings) {
+      return Separate(last, last_size, first, first_size, to);
+    }
+    char one[max_record], another[max_record];
+    last_size = ElementOf(last, last_size, one), first_size = ElementOf(first, first_size, another);
+    return Separate(one, last_size, another, first_size, to);
+  }
+
+  /*
+   * packs records [begin, end) of from into to, after the given first son,
+   * cutting off as much as they have in common; false (to untouched) if they do not fit
+   */
+  static bool Pack(node &to, long long first_son, const wide_records &from, int begin, int end) {
+    int common = from.Common(begin, end), total = 0;
+    for (int i = begin; i < end; ++i) {
+      total += from.Size(i) - common + node_page::slot_size;
+    }
+    if (total > node_capacity) {
+      return false;
+    }
+    to.first_son = first_son, to.prefix_size = common;
+    if (begin < end) {
+      memcpy(to.prefix, from.Record(begin) + sizeof(long long), common);
+    }
+    to.records.Clear();
+    char record[max_record + sizeof(long long)];
+    for (int i = begin; i < end; ++i) {
+      memcpy(record, from.Record(i), sizeof(long long));
+      memcpy(record + sizeof(long long), from.Record(i) + sizeof(long long) + common,
+             from.Size(i) - sizeof(long long) - common);
+      to.records.Append(record, from.Size(i) - common);
+    }
+    return true;
+  }
+  /*
+   * puts a record (son and whole separator) at the i-th place of todo, packing it
+   * again when the separator does not start like the others
+   * false, with todo untouched, if it does not fit
+   */
+  static bool InsertSon(node &todo, int i, const char *record, int size) {
+    const char *separator = record + sizeof(long long);
+    if (size - (int) sizeof(long long) >= todo.prefix_size
+        && !memcmp(separator, todo.prefix, todo.prefix_size)) {
+      char cut[max_record + sizeof(long long)];
+      memcpy(cut, record, sizeof(long long));
+      memcpy(cut + sizeof(long long), separator + todo.prefix_size, size - sizeof(long long) - todo.prefix_size);
+      return todo.records.Insert(i, cut, size - todo.prefix_size);
+    }
+    wide_records all;
+    all.Add(todo, 0, i), all.Add(record, size), all.Add(todo, i, todo.records.Count());
+    return Pack(todo, todo.first_son, all, 0, all.Count());
+  }
+  // the same for replacing the i-th record
+  static bool ReplaceSon(node &todo, int i, const char *record, int size) {
+    const char *separator = record + sizeof(long long);
+    if (size - (int) sizeof(long long) >= todo.prefix_size
+        && !memcmp(separator, todo.prefix, todo.prefix_size)) {
+      char cut[max_record + sizeof(long long)];
+      memcpy(cut, record, sizeof(long long));
+      memcpy(cut + sizeof(long long), separator + todo.prefix_size, size - sizeof(long long) - todo.prefix_size);
+      return todo.records.Replace(i, cut, size - todo.prefix_size);
+    }
+    wide_records all;
+    all.Add(todo, 0, i), all.Add(record, size), all.Add(todo, i + 1, todo.records.Count());
+    return Pack(todo, todo.first_son, all, 0, all.Count());
+  }
+
+  /*
+   * left is full: spreads its records, with record put in at pos, over left and
+   * right (empty) so that each gets about half of the bytes
+   */
+  static void Spread(leaf_page &left, leaf_page &right,
+                     int pos, const char *record, int size) {
+    leaf_page old = left;
+    left.Clear(), right.Clear();
+    int total = old.Used() + size + leaf_page::slot_size, num = old.Count() + 1;
+    for (int i = 0; i < num; ++i) {
+      const char *now = i < pos ? old.Record(i) : i == pos ? record : old.Record(i - 1);
+      int now_size = i < pos ? old.Size(i) : i == pos ? size : old.Size(i - 1);
+      if (i > 0 && (i == num - 1 || right.Count() || left.Used() + now_size / 2 >= total / 2)) {
+        right.Append(now, now_size);
+      } else {
+        left.Append(now, now_size);
+      }
+    }
+  }
+
+  /*
+   * @posting lists
+   * the leaf records of a tree with postings (see posting_page)
+   */
+  static int ListOf(const char *record, int size) { // where the kind byte is: the key size ends the record
+    unsigned short key_size;
+    memcpy(&key_size, record + size - sizeof(key_size), sizeof(key_size));
+    return key_size;
+  }
+  static void KeyOf(const char *record, int size, Key &key) {
+    KeyTraits<Key>::Decode(record, ListOf(record, size), key);
+  }
+  // writes the key, returning its size
+  static int PostingHead(const Key &key, char *to) {
+    int size = KeyTraits<Key>::Size(key);
+    if (size + 1 + (int) sizeof(long long) + PostingCodec<T>::MaxSize() + posting_tail > max_record) {
+      throw sjtu::runtime_error();
+    }
+    KeyTraits<Key>::Encode(key, to);
+    return size;
+  }
+  // ends a posting record of size bytes whose key took head, returning its full size
+  static int PostingTail(char *record, int head, int size) {
+    auto key_size = (unsigned short) head;
+    memcpy(record + size, &key_size, sizeof(key_size));
+    return size + posting_tail;
+  }
+  // a posting record of another alone
+  static int PostingRecord(const element &another, char *to) {
+    int head = PostingHead(another.key, to);
+    to[head] = inline_list;
+    return PostingTail(to, head, head + 1 + PostingCodec<T>::Encode(&another.value, 0, 1, to + head + 1));
+  }
+  // the key of a posting record as an element with a value of zeros, the way separators look
+  static int ElementOf(const char *record, int size, char *to) {
+    int key_size = ListOf(record, size);
+    memcpy(to, record, key_size);
+    memset(to + key_size, 0, sizeof(T));
+    return key_size + (int) sizeof(T);
+  }
+  // the first record of page whose key is not below the key of look
+  static int SearchKey(const leaf_page &page, const probe &look) {
+    if (bytewise) {
+      return Locate(page.Count(), look.target.key, nullptr, [&page, &look](int i) {
+        return look.Before(page.Record(i), ListOf(page.Record(i), page.Size(i)), false);
+      });
+    }
+    Key now;
+    return Locate(page.Count(), look.target.key, nullptr, [&page, &now, &look](int i) {
+      KeyOf(page.Record(i), page.Size(i), now);
+      return now < look.target.key;
+    });
+  }
+  // the first of values not below value, or with upper, above it
+  static int Bound(const sjtu::vector<T> &values, const T &value, bool upper) {
+    int l = 0, r = (int) values.size();
+    while (l < r) {
+      int mid = (l + r) >> 1;
+      if (upper ? !(value < values[mid]) : values[mid] < value) {
+        l = mid + 1;
+      } else {
+        r = mid;
+      }
+    }
+    return l;
+  }
+
+  // hands every value of a posting record to emit, in order
+  template<class F>
+  void ForEachPosting(const char *record, int size, F emit) {
+    int head = ListOf(record, size);
+    if (record[head] == inline_list) {
+      PostingCodec<T>::Decode(record + head + 1, size - head - 1 - posting_tail, emit);
+      return;
+    }
+    long long page;
+    memcpy(&page, record + head + 1, sizeof(long long));
+    while (page) {
+      posting_handle now = ReadPostings(page);
+      PostingCodec<T>::Decode(now->bytes, now->size, emit);
+      page = now->next_pos;
+    }
+  }
+
+  /*
+   * adds another.value to the list of its key, whose record is the one at search
+   * if there is one; 0 if that was done in place, otherwise the size of the
+   * record left in record, still to be put in at search
+   */
+  int AddPosting(leaf_handle &todo_leaf, int search, const element &another, char *record) {
+    leaf_page &page = todo_leaf->records;
+    int head = PostingHead(another.key, record);
+    Key found = Key();
+    if (search < page.Count()) {
+      KeyOf(page.Record(search), page.Size(search), found);
+    }
+    if (search == page.Count() || another.key < found) { // a new key
+      return PostingRecord(another, record);
+    }
+    const char *old = page.Record(search);
+    if (old[head] == overflow_list) {
+      long long first;
+      memcpy(&first, old + head + 1, sizeof(long long));
+      AddToChain(first, another.value);
+      return 0;
+    }
+    sjtu::vector<T> values;
+    PostingCodec<T>::Decode(old + head + 1, page.Size(search) - head - 1 - posting_tail,
+                            [&values](const T &now) { values.push_back(now); });
+    values.insert(Bound(values, another.value, true), another.value);
+    char list[2 * max_record];
+    int size = PostingCodec<T>::Encode(values, 0, (int) values.size(), list);
+    if (head + 1 + size + posting_tail <= max_record) {
+      record[head] = inline_list;
+      memcpy(record + head + 1, list, size);
+      size = PostingTail(record, head, head + 1 + size);
+    } else { // moving out to a posting page
+      posting_handle chunk = NewPostings();
+      memcpy(chunk->bytes, list, size);
+      chunk->size = size, chunk.Dirty();
+      record[head] = overflow_list;
+      memcpy(record + head + 1, &chunk->address, sizeof(long long));
+      size = PostingTail(record, head, head + 1 + (int) sizeof(long long));
+    }
+    todo_leaf.Dirty();
+    if (page.Replace(search, record, size)) {
+      return 0;
+    }
+    page.Erase(search);
+    return size;
+  }
+  // the page of the chain from page where value belongs: the last one not starting above it
+  posting_handle ChunkOf(long long page, const T &value, posting_handle *before) {
+    posting_handle now = ReadPostings(page);
+    while (now->next_pos) {
+      posting_handle next = ReadPostings(now->next_pos);
+      if (value < PostingCodec<T>::First(next->bytes)) {
+        break;
+      }
+      if (before) {
+        *before = std::move(now);
+      }
+      now = std::move(next);
+    }
+    return now;
+  }
+  void AddToChain(long long page, const T &value) {
+    posting_handle now = ChunkOf(page, value, nullptr);
+    sjtu::vector<T> values;
+    PostingCodec<T>::Decode(now->bytes, now->size, [&values](const T &one) { values.push_back(one); });
+    values.insert(Bound(values, value, true), value);
+    char bytes[posting_capacity + max_record];
+    int size = PostingCodec<T>::Encode(values, 0, (int) values.size(), bytes), half = (int) values.size() / 2;
+    now.Dirty();
+    if (size <= posting_capacity) {
+      memcpy(now->bytes, bytes, size);
+      now->size = size;
+      return;
+    }
+    // a full page splits in halves
+    posting_handle next = NewPostings();
+    next->size = PostingCodec<T>::Encode(values, half, (int) values.size(), next->bytes);
+    now->size = PostingCodec<T>::Encode(values, 0, half, now->bytes);
+    next->next_pos = now->next_pos, now->next_pos = next->address;
+    next.Dirty();
+  }
+
+  /*
+   * takes one another.value off the list of its key, whose record is the one at
+   * search if there is one; the record goes with the last value
+   * false if there was nothing to take
+   */
+  bool RemovePosting(leaf_handle &todo_leaf, int search, const element &another) {
+    leaf_page &page = todo_leaf->records;
+    Key found;
+    if (search == page.Count()) {
+      return false;
+    }
+    KeyOf(page.Record(search), page.Size(search), found);
+    if (another.key < found) {
+      return false;
+    }
+    char record[max_record + sizeof(long long)];
+    int head = ListOf(page.Record(search), page.Size(search));
+    memcpy(record, page.Record(search), head + 1);
+    if (record[head] == inline_list) {
+      sjtu::vector<T> values;
+      PostingCodec<T>::Decode(page.Record(search) + head + 1, page.Size(search) - head - 1 - posting_tail,
+                              [&values](const T &now) { values.push_back(now); });
+      int at = Bound(values, another.value, false);
+      if (at == (int) values.size() || another.value < values[at]) {
+        return false;
+      }
+      values.erase(at);
+      if (values.size()) {
+        int size = PostingCodec<T>::Encode(values, 0, (int) values.size(), record + head + 1);
+        page.Replace(search, record, PostingTail(record, head, head + 1 + size));
+      } else {
+        page.Erase(search);
+      }
+      todo_leaf.Dirty();
+      return true;
+    }
+    long long first, now_first;
+    memcpy(&first, page.Record(search) + head + 1, sizeof(long long));
+    now_first = first;
+    if (!RemoveFromChain(now_first, another.value)) {
+      return false;
+    }
+    todo_leaf.Dirty();
+    if (!now_first) {
+      page.Erase(search);
+      return true;
+    }
+    posting_handle chunk = ReadPostings(now_first);
+    int size = head + 1 + chunk->size + posting_tail;
+    if (!chunk->next_pos && size <= max_record / 2 && page.Fits(search, size)) {
+      // few enough values to come back inline
+      record[head] = inline_list;
+      memcpy(record + head + 1, chunk->bytes, chunk->size);
+      page.Replace(search, record, PostingTail(record, head, head + 1 + chunk->size));
+      chunk.Release(), FreePostings(now_first);
+    } else if (now_first != first) {
+      memcpy(record + head + 1, &now_first, sizeof(long long));
+      page.Replace(search, record, PostingTail(record, head, head + 1 + (int) sizeof(long long)));
+    }
+    return true;
+  }
+  // first becomes 0 if the chain empties; pages are unlinked as they do
+  bool RemoveFromChain(long long &first, const T &value) {
+    posting_handle before;
+    posting_handle now = ChunkOf(first, value, &before);
+    sjtu::vector<T> values;
+    PostingCodec<T>::Decode(now->bytes, now->size, [&values](const T &one) { values.push_back(one); });
+    int at = Bound(values, value, false);
+    if (at == (int) values.size() || value < values[at]) {
+      return false;
+    }
+    values.erase(at);
+    if (values.size()) {
+      now->size = PostingCodec<T>::Encode(values, 0, (int) values.size(), now->bytes), now.Dirty();
+      return true;
+    }
+    long long freed = now->address;
+    if (before) {
+      before->next_pos = now->next_pos, before.Dirty();
+    } else {
+      first = now->next_pos;
+    }
+    now.Release(), FreePostings(freed);
+    return true;
+  }
+
+  // puts look.target into todo_leaf, son pos of father; true means father was split, see NodeInsert
+  bool LeafInsert(node_handle &father, int pos, leaf_handle &todo_leaf, const probe &look, split_info &up,
+                  latch_path &path) {
+    const element &another = look.target;
+    char record[max_record + sizeof(long long)];
+    int size, search;
+    if (path.logging) {
+      Log(log_insert, another);
+    }
+    if (data_begin.postings) {
+      search = SearchKey(todo_leaf->records, look);
+      if (!(size = AddPosting(todo_leaf, search, another, record))) {
+        return false;
+      }
+    } else {
+      size = Encode(another, record);
+      search = Search(todo_leaf->records, look, true);
+    }
+    todo_leaf.Dirty();
+    if (todo_leaf->records.Insert(search, record, size)) {
+      return false;
+    }
+    // block splitting
+    leaf_handle new_block = NewLeaf();
+    Spread(todo_leaf->records, new_block->records, search, record, size);
+    new_block->next_pos = todo_leaf->next_pos, todo_leaf->next_pos = new_block->address;
+    new_block->prev_pos = todo_leaf->address;
+    LinkBack(path, new_block->next_pos, new_block->address);
+    // the shortest thing between the two blocks separates them
+    const leaf_page &left = todo_leaf->records, &right = new_block->records;
+    size = SeparateLeaves(left.Record(left.Count() - 1), left.Size(left.Count() - 1),
+                          right.Record(0), right.Size(0), record + sizeof(long long));
+    memcpy(record, &new_block->address, sizeof(long long));
+    size += (int) sizeof(long long);
+    // the new son goes right after son pos
+    return NodeInsert(father, pos - 1, record, size, up);
+  }
+  /*
+   * puts record, a son and its separator, at the i-th place of todo; true means
+   * todo was split, its upper half going to up.page, the node right of it, with
+   * up.separator in between, still to be put into the level above (see
+   * InsertAbove); the root keeps its address instead, its halves moving out
+   * below it
+   */
+  bool NodeInsert(node_handle &todo, int i, const char *record, int size, split_info &up) {
+    todo.Dirty();
+    if (InsertSon(*todo, i, record, size)) {
+      return false;
+    }
+    // needing to split: the record in the middle goes up, its son heading the new node
+    wide_records all;
+    all.Add(*todo, 0, i), all.Add(record, size), all.Add(*todo, i, todo->records.Count());
+    int middle = all.Middle(0, all.Count());
+    node_handle new_node = NewNode();
+    new_node->level = todo->level;
+    long long middle_son;
+    memcpy(&middle_son, all.Record(middle), sizeof(long long));
+    Pack(*todo, todo->first_son, all, 0, middle);
+    Pack(*new_node, middle_son, all, middle + 1, all.Count());
+    up.page = new_node->address, up.size = all.Size(middle) - (int) sizeof(long long);
+    memcpy(up.separator, all.Record(middle) + sizeof(long long), up.size);
+    // the new node comes in between todo and the one right of it
+    SetRight(*new_node, todo->right, todo->high, todo->high_size);
+    SetRight(*todo, up.page, up.separator, up.size);
+    if (todo->address != tree_begin.start_place) {
+      return true;
+    }
+    node_handle old_root = NewNode();
+    long long old_address = old_root->address;
+    *old_root = *todo;
+    old_root->address = old_address;
+    ++todo->level, todo->right = 0;
+    char son_record[max_record + sizeof(long long)];
+    wide_records sons;
+    sons.Add(son_record, SonRecord(up.page, up.separator, up.size, son_record));
+    Pack(*todo, old_address, sons, 0, 1);
+    return false;
+  }
+  // puts up, a node split off at level - 1, into the level above, and so on as long as nodes split
+  void InsertAbove(split_info &up, int level) {
+    char record[max_record + sizeof(long long)];
+    for (bool split = true; split; ++level) {
+      latch_path path(this);
+      probe look(up.separator, up.size);
+      node_handle todo = LatchCovering(path, look, level, true);
+      int size = SonRecord(up.page, up.separator, up.size, record);
+      split = NodeInsert(todo, SearchNode(*todo, look, true), record, size, up);
+    }
+  }
+  // links todo to right, the separator in front of it being the high key of todo
+  static void SetRight(node &todo, long long right, const char *separator, int size) {
+    todo.right = right, todo.high_size = size;
+    memcpy(todo.high, separator, size);
+  }
+
+  // takes look.target out of todo_leaf, son pos of father; true means father fell short of records
+  bool LeafErase(node_handle &father, int pos, leaf_handle &todo_leaf, const probe &look, latch_path &path) {
+    const element &another = look.target;
+    int sons = father->Sons();
+    long long son = father->Son(pos);
+    if (path.logging) {
+      Log(log_erase, another);
+    }
+    if (data_begin.postings) {
+      if (!RemovePosting(todo_leaf, SearchKey(todo_leaf->records, look), another)) {
+        return false;
+      }
+    } else {
+      int search = Search(todo_leaf->records, look, false);
+      if (search == todo_leaf->records.Count()) {
+        return false;
+      }
+      element found;
+      Decode(todo_leaf->records.Record(search), todo_leaf->records.Size(search), found);
+      if (!(another == found)) {
+        // not even deleting
+        return false;
+      }
+      todo_leaf->records.Erase(search), todo_leaf.Dirty();
+    }
+    if (todo_leaf->records.Used() >= leaf_underflow || sons == 1) {
+      // need no adjustment, or only son and can't do anything
+      return false;
+    }
+    // leaf adjusting, with the one behind or, for the last son, the one at front
+    leaf_handle before, after;
+    if (pos < sons) {
+      before = std::move(todo_leaf), after = ReadLeaf(father->Son(pos + 1));
+      LatchLeaf(path, father->Son(pos + 1));
+    } else { // latched again after the one at front, leaves going left to right
+      Forget(path.leaves, leaf_latches, son);
+      before = ReadLeaf(father->Son(pos - 1)), after = std::move(todo_leaf), --pos;
+      LatchLeaf(path, father->Son(pos)), LatchLeaf(path, son);
+    }
+    AdjustLeaves(father, pos, before, after, path);
+    return father->records.Used() < node_underflow;
+  }
+  /*
+   * evens out the son of the node at level where look belongs, short of records,
+   * with a sibling next to it, and so on up while fathers fall short; the root
+   * is lowered once left with a single son
+   */
+  void Rebalance(const probe &look, int level) {
+    for (;; ++level) {
+      latch_path path(this);
+      node_handle todo = LatchCovering(path, look, level, true);
+      if (todo->level != level) { // the tree got lower meanwhile
+        return;
+      }
+      int pos = SonOf(*todo, look), sons = todo->Sons();
+      if (sons > 1) {
+        long long son = todo->Son(pos);
+        node_handle before, after;
+        if (pos < sons) {
+          before = ReadNode(son), after = ReadNode(todo->Son(pos + 1));
+          LatchNode(path, son), LatchNode(path, todo->Son(pos + 1));
+        } else { // left to right
+          --pos;
+          before = ReadNode(todo->Son(pos)), after = ReadNode(son);
+          LatchNode(path, todo->Son(pos)), LatchNode(path, son);
+        }
+        // nothing moves past a split not finished yet, and the son may have filled up meanwhile
+        if (before->right == after->address
+            && std::min(before->records.Used(), after->records.Used()) < node_underflow) {
+          AdjustNodes(todo, pos, before, after, path);
+        }
+      }
+      ReleaseNodes(path, 1);
+      if (todo->address == tree_begin.start_place) {
+        LowerRoot(todo, path);
+        return;
+      }
+      if (todo->records.Used() >= node_underflow) {
+        return;
+      }
+    }
+  }
+
+  /*
+   * before and after are sons pos and pos + 1 of todo, one of them short of records:
+   * they are merged if one page holds both, otherwise records move over until
+   * both hold about as many bytes, provided the new separator fits in todo
+   */
+  void AdjustLeaves(node_handle &todo, int pos, leaf_handle &before, leaf_handle &after, latch_path &path) {
+    leaf_page &left = before->records, &right = after->records;
+    const int slot = leaf_page::slot_size;
+    if (left.Used() + right.Used() <= leaf_capacity) {
+      // merging the one behind
+      for (int i = 0; i < right.Count(); ++i) {
+        left.Append(right.Record(i), right.Size(i));
+      }
+      before->next_pos = after->next_pos, before.Dirty();
+      LinkBack(path, before->next_pos, before->address);
+      long long freed = after->address;
+      after.Release(), FreeLeaf(path, freed);
+      todo->records.Erase(pos - 1), todo.Dirty();
+      return;
+    }
+    // borrowing behind (from the front of after) or at front (from the back of before)
+    int a = left.Used(), b = right.Used(), num = 0;
+    bool behind = a < b;
+    int last; // the last record to stay in (or go to) before, within the two
+    if (behind) {
+      while (num < right.Count() - 1 && right.Size(num) + slot < b - a) {
+        a += right.Size(num) + slot, b -= right.Size(num) + slot, ++num;
+      }
+      last = left.Count() + num - 1;
+    } else {
+      while (num < left.Count() - 1 && left.Size(left.Count() - 1 - num) + slot < a - b) {
+        a -= left.Size(left.Count() - 1 - num) + slot, b += left.Size(left.Count() - 1 - num) + slot, ++num;
+      }
+      last = left.Count() - num - 1;
+    }
+    if (!num) {
+      return;
+    }
+    // the separator goes in first: nothing moves if it does not fit
+    auto at = [&left, &right](int i) { return i < left.Count() ? left.Record(i) : right.Record(i - left.Count()); };
+    auto size_at = [&left, &right](int i) { return i < left.Count() ? left.Size(i) : right.Size(i - left.Count()); };
+    char record[max_record + sizeof(long long)];
+    int size = SeparateLeaves(at(last), size_at(last), at(last + 1), size_at(last + 1), record + sizeof(long long));
+    memcpy(record, &after->address, sizeof(long long));
+    if (!ReplaceSon(*todo, pos - 1, record, size + (int) sizeof(long long))) {
+      return;
+    }
+    for (int i = 0; i < num; ++i) {
+      if (behind) {
+        left.Append(right.Record(0), right.Size(0));
+        right.Erase(0);
+      } else {
+        right.Insert(0, left.Record(left.Count() - 1), left.Size(left.Count() - 1));
+        left.Erase(left.Count() - 1);
+      }
+    }
+    todo.Dirty(), before.Dirty(), after.Dirty();
+  }
+
+  // points the leaf at page, if any, back to the one at prev
+  void LinkBack(latch_path &path, long long page, long long prev) {
+    if (page) {
+      leaf_handle after = ReadLeaf(page);
+      LatchLeaf(path, page);
+      after->prev_pos = prev, after.Dirty();
+    }
+  }
+
+  /*
+   * the same for two nodes, whose records move through the separator in todo:
+   * everything is written out in full and packed again, into before alone or
+   * split evenly with the record in the middle going up
+   */
+  void AdjustNodes(node_handle &todo, int pos, node_handle &before, node_handle &after, latch_path &path) {
+    char record[max_record + sizeof(long long)];
+    wide_records all;
+    all.Add(*before, 0, before->records.Count());
+    memcpy(record, &after->first_son, sizeof(long long));
+    all.Add(record, todo->Separator(pos + 1, record + sizeof(long long)) + (int) sizeof(long long));
+    all.Add(*after, 0, after->records.Count());
+    if (Pack(*before, before->first_son, all, 0, all.Count())) {
+      // merging the one behind
+      SetRight(*before, after->right, after->high, after->high_size), before.Dirty();
+      long long freed = after->address;
+      after.Release(), FreeNode(path, freed);
+      todo->records.Erase(pos - 1), todo.Dirty();
+      return;
+    }
+    // borrowing
+    int middle = all.Middle(0, all.Count());
+    if (middle == -1) {
+      return;
+    }
+    memcpy(record, &after->address, sizeof(long long));
+    memcpy(record + sizeof(long long), all.Record(middle) + sizeof(long long), all.Size(middle) - sizeof(long long));
+    if (!ReplaceSon(*todo, pos - 1, record, all.Size(middle))) {
+      return;
+    }
+    long long middle_son;
+    memcpy(&middle_son, all.Record(middle), sizeof(long long));
+    Pack(*before, before->first_son, all, 0, middle);
+    Pack(*after, middle_son, all, middle + 1, all.Count());
+    SetRight(*before, after->address, record + sizeof(long long), all.Size(middle) - (int) sizeof(long long));
+    todo.Dirty(), before.Dirty(), after.Dirty();
+  }
+
+  /*
+   * @latching, the pieces; all of them do nothing unless concurrent
+   */
+  // copies the node at page to to without latching it, giving its version; false if a writer got in the way
+  bool ReadOptimistic(long long page, node &to, unsigned &version) {
+    const node *from = cache.Resident<node>(tree_file, page);
+    node_handle pinned;
+    if (!from) {
+      pinned = ReadNode(page);
+      from = &*pinned;
+    }
+    version = node_latches.Snapshot(page);
+    to.CopyFrom(*from);
+    if (!node_latches.Validate(page, version)) {
+      return false;
+    }
+    if (pinned && to.level > 1) {
+      cache.Keep(pinned);
+    }
+    return true;
+  }
+  unsigned LeafVersion(long long page) {
+    return concurrent ? leaf_latches.Version(page) : 0;
+  }
+  shared_leaf ReadShared(long long page) {
+    shared_leaf ret;
+    ret.leaf = ReadLeaf(page);
+    if (concurrent) {
+      leaf_latches.LockShared(page);
+      ret.latches = &leaf_latches;
+    }
+    return ret;
+  }
+  // a writer latching a node, or a leaf, last on its path
+  void LatchNode(latch_path &path, long long page) {
+    if (concurrent) {
+      node_latches.Lock(page);
+      path.nodes.push_back(page);
+    }
+  }
+  void LatchLeaf(latch_path &path, long long page) {
+    if (concurrent) {
+      leaf_latches.Lock(page);
+      path.leaves.push_back(page);
+    }
+  }
+  // lets go of the nodes of path from the from-th on, and of the one latched shared
+  void ReleaseNodes(latch_path &path, int from = 0) {
+    while ((int) path.nodes.size() > from) {
+      node_latches.Unlock(path.nodes.back());
+      path.nodes.pop_back();
+    }
+    if (path.shared) {
+      node_latches.UnlockShared(path.shared);
+      path.shared = 0;
+    }
+  }
+  void ReleaseLeaves(latch_path &path) {
+    for (int i = 0; i < (int) path.leaves.size(); ++i) {
+      leaf_latches.Unlock(path.leaves[i]);
+    }
+    path.leaves.clear();
+  }
+  // lets go of page early, if it is among held
+  void Forget(sjtu::vector<long long> &held, PageLatches &latches, long long page) {
+    for (int i = 0; i < (int) held.size(); ++i) {
+      if (held[i] == page) {
+        latches.Unlock(page);
+        held.erase(i);
+        return;
+      }
+    }
+  }
+  // whether a leaf takes any record, or loses any, without being split or falling short
+  static bool SafeLeaf(const leaves &todo, bool inserting) {
+    const int most = max_record + leaf_page::slot_size;
+    return inserting ? todo.records.Free() >= most : todo.records.Used() - most >= leaf_underflow;
+  }
+
+  /*
+   * page access
+   * every block is reached through a handle: a pinned frame of the cache, or,
+   * when mapped, the page inside the mapping itself; either way nothing is
+   * copied, and changes only need the handle to be marked dirty
+   */
+  node_handle ReadNode(long long page) {
+    if (mapped) {
+      return node_handle(reinterpret_cast<node *>(tree_map.At(page * node_size)));
+    }
+    return cache.Pin<node>(tree_file, page);
+  }
+  leaf_handle ReadLeaf(long long page) {
+    if (mapped) {
+      return leaf_handle(reinterpret_cast<leaves *>(data_map.At(page * leaf_size)));
+    }
+    return cache.Pin<leaves>(data_file, page);
+  }
+  node_handle CreateNode(long long page) {
+    node_handle ret;
+    if (mapped) {
+      tree_map.Reserve((page + 1) * node_size);
+      ret = node_handle(reinterpret_cast<node *>(tree_map.At(page * node_size)));
+      *ret = node();
+    } else {
+      ret = cache.Create<node>(tree_file, page);
+    }
+    ret->address = page;
+    return ret;
+  }
+  // the leaves of the run page lies in, which a cursor walking leaves laid out one after
+  // another, as BulkLoad leaves them, is about to want (see CachePool::Prefetch)
+  void ReadAhead(long long page) {
+    if (!mapped) {
+      cache.Prefetch<leaves>(data_file, page);
+    }
+  }
+  leaf_handle CreateLeaf(long long page) {
+    leaf_handle ret;
+    if (mapped) {
+      data_map.Reserve((page + 1) * leaf_size);
+      ret = leaf_handle(reinterpret_cast<leaves *>(data_map.At(page * leaf_size)));
+      *ret = leaves();
+    } else {
+      ret = cache.Create<leaves>(data_file, page);
+    }
+    ret->address = page;
+    return ret;
+  }
+  node_handle NewNode() {
+    std::lock_guard<std::mutex> guard(alloc_latch);
+    if (tree_bin.empty()) {
+      return CreateNode(tree_begin.end_place++);
+    }
+    return CreateNode(tree_bin.pop_back());
+  }
+  leaf_handle NewLeaf() {
+    std::lock_guard<std::mutex> guard(alloc_latch);
+    if (data_bin.empty()) {
+      return CreateLeaf(data_begin.end_place++);
+    }
+    return CreateLeaf(data_bin.pop_back());
+  }
+  posting_handle ReadPostings(long long page) {
+    if (mapped) {
+      return posting_handle(reinterpret_cast<posting_page *>(data_map.At(page * leaf_size)));
+    }
+    return cache.Pin<posting_page>(data_file, page);
+  }
+  // posting pages take their places from the leaves
+  posting_handle NewPostings() {
+    std::lock_guard<std::mutex> guard(alloc_latch);
+    long long page = data_bin.empty() ? data_begin.end_place++ : data_bin.pop_back();
+    posting_handle ret;
+    if (mapped) {
+      data_map.Reserve((page + 1) * leaf_size);
+      ret = posting_handle(reinterpret_cast<posting_page *>(data_map.At(page * leaf_size)));
+      *ret = posting_page();
+    } else {
+      ret = cache.Create<posting_page>(data_file, page);
+    }
+    ret->address = page;
+    return ret;
+  }
+  void FreePostings(long long page) {
+    std::lock_guard<std::mutex> guard(alloc_latch);
+    if (!mapped) {
+      cache.Discard(data_file, page);
+    }
+    data_bin.push_back(page);
+  }
+  // freed blocks are let go of first, so that whoever gets one next finds it free
+  void FreeNode(latch_path &path, long long page) {
+    Forget(path.nodes, node_latches, page);
+    std::lock_guard<std::mutex> guard(alloc_latch);
+    if (!mapped) {
+      cache.Discard(tree_file, page);
+    }
+    tree_bin.push_back(page);
+  }
+  void FreeLeaf(latch_path &path, long long page) {
+    Forget(path.leaves, leaf_latches, page);
+    std::lock_guard<std::mutex> guard(alloc_latch);
+    if (!mapped) {
+      cache.Discard(data_file, page);
+    }
+    data_bin.push_back(page);
+  }
+  /*
+   * raw transfer at byte offsets, bypassing the caches
+   */
+  void ReadTreeBlock(long long place, void *obj, int size) {
+    if (mapped) {
+      memcpy(obj, tree_map.At(place), size);
+    } else {
+      tree.Read(place, obj, size);
+    }
+  }
+  void ReadDataBlock(long long place, void *obj, int size) {
+    if (mapped) {
+      memcpy(obj, data_map.At(place), size);
+    } else {
+      data.Read(place, obj, size);
+    }
+  }
+  void WriteTreeBlock(long long place, const void *obj, int size) {
+    if (mapped) {
+      tree_map.Reserve(place + size);
+      memcpy(tree_map.At(place), obj, size);
+    } else {
+      tree.Write(place, obj, size);
+    }
+  }
+  void WriteDataBlock(long long place, const void *obj, int size) {
+    if (mapped) {
+      data_map.Reserve(place + size);
+      memcpy(data_map.At(place), obj, size);
+    } else {
+      data.Write(place, obj, size);
+    }
   }
   void UpdateData() {
-    data.seekp(0);
-    data.write(reinterpret_cast<char *>(&data_begin), sizeof(data_begin));
+    WriteDataBlock(0, &data_begin, sizeof(data_begin));
   }
   void UpdateTree() {
-    data.seekp(0);
-    data.write(reinterpret_cast<char *>(&tree_begin), sizeof(tree_begin));
+    WriteTreeBlock(0, &tree_begin, sizeof(tree_begin));
   }
 };
 #endif //BPT__BPT_HPP_
\ No newline at end of file
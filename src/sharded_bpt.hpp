@@ -0,0 +1,348 @@
+#ifndef BPT__SHARDED_BPT_HPP_
+#define BPT__SHARDED_BPT_HPP_
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "bpt.hpp"
+#include "vector.hpp"
+
+const int shard_queue_limit = 1 << 16; // operations a worker may have waiting before writers wait for it
+
+/*
+ * @class ShardedBPlusTree
+ * a front end spreading keys over shards independent BPlusTrees by a hash of
+ * their encoded bytes, each with files ("<name>'s shard i"), bins, cache and
+ * log of its own, so writes to different shards never meet
+ * every shard is served by one of workers threads, which takes its operations
+ * in the order they were queued: insert and erase only queue theirs and return,
+ * find waits for its answer, which therefore sees every operation queued
+ * before it; a failure of a queued operation is thrown by the next call that
+ * waits on its worker
+ * the elements of a key all live in one shard, so ordered access merges the
+ * shards' own cursors (see cursor) once everything queued is done; it and the
+ * other calls waiting for every worker want no writers meanwhile, as a cursor
+ * of a tree does
+ * the files must be opened again with as many shards; cache_budget is split
+ * evenly among them
+ */
+template<class Key, class T, int PageSize = default_page_size>
+class ShardedBPlusTree {
+  typedef BPlusTree<Key, T, PageSize> tree_type;
+  enum TaskOp { task_insert, task_erase, task_find, task_checkpoint, task_sync };
+ private:
+  struct task {
+    TaskOp op;
+    int shard;
+    Key key;
+    T value;
+    sjtu::vector<T> *found; // where find puts the values
+  };
+  struct worker {
+    std::mutex latch;
+    std::condition_variable wake, done;
+    std::thread thread;
+    sjtu::vector<task> *waiting = new sjtu::vector<task>, *running = new sjtu::vector<task>;
+    long long queued = 0, finished = 0; // tasks so far, and how many of them are done
+    bool idle = false, stopping = false;
+    std::exception_ptr failed; // the first failure not thrown yet
+
+    ~worker() {
+      delete waiting;
+      delete running;
+    }
+  };
+  int shard_num, worker_num;
+  tree_type **shards;
+  worker *workers;
+
+  void work(worker &now) {
+    std::unique_lock<std::mutex> lock(now.latch);
+    while (true) {
+      now.idle = true;
+      now.wake.wait(lock, [&now] { return now.stopping || now.waiting->size(); });
+      now.idle = false;
+      if (!now.waiting->size()) { // stopping with nothing left
+        return;
+      }
+      std::swap(now.waiting, now.running);
+      lock.unlock();
+      std::exception_ptr failed;
+      for (int i = 0; i < (int) now.running->size(); ++i) {
+        task &todo = (*now.running)[i];
+        tree_type &shard = *shards[todo.shard];
+        try {
+          switch (todo.op) {
+            case task_insert: shard.insert(todo.key, todo.value);
+              break;
+            case task_erase: shard.erase(todo.key, todo.value);
+              break;
+            case task_find: shard.find_into(todo.key, *todo.found);
+              break;
+            case task_checkpoint: shard.Checkpoint();
+              break;
+            case task_sync: shard.Sync();
+              break;
+          }
+        } catch (...) {
+          if (!failed) {
+            failed = std::current_exception();
+          }
+        }
+      }
+      long long count = (long long) now.running->size();
+      now.running->clear();
+      lock.lock();
+      if (failed && !now.failed) {
+        now.failed = failed;
+      }
+      now.finished += count;
+      now.done.notify_all();
+    }
+  }
+  // the shard of key: FNV-1a over its encoded bytes
+  int ShardOf(const Key &key) const {
+    char buffer[256];
+    std::string longer;
+    int size = KeyTraits<Key>::Size(key);
+    char *bytes = buffer;
+    if (size > (int) sizeof(buffer)) {
+      longer.resize(size), bytes = &longer[0];
+    }
+    KeyTraits<Key>::Encode(key, bytes);
+    unsigned hash = 2166136261u;
+    for (int i = 0; i < size; ++i) {
+      hash = (hash ^ (unsigned char) bytes[i]) * 16777619u;
+    }
+    return (int) (hash % (unsigned) shard_num);
+  }
+  // queues todo on the worker of its shard, giving its place in that worker's order
+  long long Queue(const task &todo) {
+    worker &now = workers[todo.shard % worker_num];
+    std::unique_lock<std::mutex> lock(now.latch);
+    now.done.wait(lock, [&now] { return (int) now.waiting->size() < shard_queue_limit; });
+    now.waiting->push_back(todo);
+    if (now.idle) {
+      now.idle = false;
+      now.wake.notify_one();
+    }
+    return ++now.queued;
+  }
+  // waits until the worker has done its ticket-th task, throwing whatever failed so far
+  void WaitFor(worker &now, long long ticket) {
+    std::unique_lock<std::mutex> lock(now.latch);
+    now.done.wait(lock, [&now, ticket] { return now.finished >= ticket; });
+    if (now.failed) {
+      std::exception_ptr failed = now.failed;
+      now.failed = nullptr;
+      std::rethrow_exception(failed);
+    }
+  }
+  // runs op on every shard at once, on their workers, and waits for all of them
+  void Everywhere(TaskOp op) {
+    for (int i = 0; i < shard_num; ++i) {
+      Queue(task{op, i, Key(), T(), nullptr});
+    }
+    Wait();
+  }
+ public:
+  /*
+   * the files of the shards are named after _tree_name and _data_name, and their
+   * logs after _log_name if there is one; the rest is as for BPlusTree, workers
+   * being at most shards
+   */
+  ShardedBPlusTree(const std::string &_tree_name, const std::string &_data_name, int _shards,
+                   int _workers = 0, bool mapped = false, long long cache_budget = default_budget,
+                   CachePolicy cache_policy = lru, const std::string &_log_name = "", bool postings = false,
+                   bool direct = false)
+      : shard_num(std::max(1, _shards)),
+        worker_num(_workers > 0 ? std::min(_workers, std::max(1, _shards)) : std::max(1, _shards)) {
+    shards = new tree_type *[shard_num];
+    for (int i = 0; i < shard_num; ++i) {
+      std::string suffix = "'s shard " + std::to_string(i);
+      shards[i] = new tree_type(_tree_name + suffix, _data_name + suffix, mapped, cache_budget / shard_num,
+                                cache_policy, _log_name.empty() ? "" : _log_name + suffix, postings, direct);
+    }
+    workers = new worker[worker_num];
+    for (int i = 0; i < worker_num; ++i) {
+      workers[i].thread = std::thread(&ShardedBPlusTree::work, this, std::ref(workers[i]));
+    }
+  }
+  ShardedBPlusTree(const ShardedBPlusTree &) = delete;
+  ShardedBPlusTree &operator=(const ShardedBPlusTree &) = delete;
+  // whatever is queued is done first
+  ~ShardedBPlusTree() {
+    for (int i = 0; i < worker_num; ++i) {
+      {
+        std::lock_guard<std::mutex> guard(workers[i].latch);
+        workers[i].stopping = true;
+      }
+      workers[i].wake.notify_one();
+      workers[i].thread.join();
+    }
+    delete[] workers;
+    for (int i = 0; i < shard_num; ++i) {
+      delete shards[i];
+    }
+    delete[] shards;
+  }
+
+  int Shards() const {
+    return shard_num;
+  }
+
+  void insert(const Key &key, const T &val) {
+    Queue(task{task_insert, ShardOf(key), key, val, nullptr});
+  }
+  void erase(const Key &key, const T &val) {
+    Queue(task{task_erase, ShardOf(key), key, val, nullptr});
+  }
+
+  sjtu::vector<T> find(const Key &key) {
+    sjtu::vector<T> ret;
+    find_into(key, ret);
+    return ret;
+  }
+  // the same into ret, emptied first
+  void find_into(const Key &key, sjtu::vector<T> &ret) {
+    int shard = ShardOf(key);
+    WaitFor(workers[shard % worker_num], Queue(task{task_find, shard, key, T(), &ret}));
+  }
+
+  // waits until every operation queued so far is done
+  void Wait() {
+    for (int i = 0; i < worker_num; ++i) {
+      long long ticket;
+      {
+        std::lock_guard<std::mutex> guard(workers[i].latch);
+        ticket = workers[i].queued;
+      }
+      WaitFor(workers[i], ticket);
+    }
+  }
+  // Checkpoint and Sync of every shard, all of them at once (see BPlusTree)
+  void Checkpoint() {
+    Everywhere(task_checkpoint);
+  }
+  void Sync() {
+    Everywhere(task_sync);
+  }
+  // before anything is queued
+  void StartFlusher(double dirty_ratio = 0.25, int checkpoint_ms = 1000) {
+    for (int i = 0; i < shard_num; ++i) {
+      shards[i]->StartFlusher(dirty_ratio, checkpoint_ms);
+    }
+  }
+  CacheStats CacheStatistics() {
+    Wait();
+    CacheStats ret;
+    for (int i = 0; i < shard_num; ++i) {
+      CacheStats now = shards[i]->CacheStatistics();
+      ret.hits += now.hits, ret.misses += now.misses;
+    }
+    return ret;
+  }
+
+  /*
+   * @class cursor
+   * a position among the elements of all shards, in order of key and then
+   * value: a cursor of every shard, the one with the least element on top of a
+   * heap, so next costs a step of one shard's cursor and a log of the shards
+   * forward only, and like them gone with any write
+   */
+  class cursor {
+    friend class ShardedBPlusTree;
+    typedef typename tree_type::cursor shard_cursor;
+    shard_cursor *parts = nullptr;
+    int *heap = nullptr, heap_size = 0;
+
+    // the heap keeps the shard with the least element on top
+    bool after(int i, int j) const {
+      const shard_cursor &x = parts[i], &y = parts[j];
+      return y.key() < x.key() || (!(x.key() < y.key()) && y.value() < x.value());
+    }
+    void start(int num) {
+      heap = new int[num];
+      for (int i = 0; i < num; ++i) {
+        if (parts[i].valid()) {
+          heap[heap_size++] = i;
+        }
+      }
+      std::make_heap(heap, heap + heap_size, [this](int i, int j) { return after(i, j); });
+    }
+   public:
+    cursor() = default;
+    cursor(cursor &&other) noexcept : parts(other.parts), heap(other.heap), heap_size(other.heap_size) {
+      other.parts = nullptr, other.heap = nullptr, other.heap_size = 0;
+    }
+    cursor &operator=(cursor &&other) noexcept {
+      if (this != &other) {
+        delete[] parts;
+        delete[] heap;
+        parts = other.parts, heap = other.heap, heap_size = other.heap_size;
+        other.parts = nullptr, other.heap = nullptr, other.heap_size = 0;
+      }
+      return *this;
+    }
+    ~cursor() {
+      delete[] parts;
+      delete[] heap;
+    }
+
+    bool valid() const {
+      return heap_size > 0;
+    }
+    const Key &key() const {
+      return parts[heap[0]].key();
+    }
+    const T &value() const {
+      return parts[heap[0]].value();
+    }
+    void next() {
+      auto order = [this](int i, int j) { return after(i, j); };
+      std::pop_heap(heap, heap + heap_size, order);
+      shard_cursor &now = parts[heap[heap_size - 1]];
+      now.next();
+      if (now.valid()) {
+        std::push_heap(heap, heap + heap_size, order);
+      } else {
+        --heap_size;
+      }
+    }
+  };
+
+  // cursors as in BPlusTree, once every operation queued is done
+  cursor begin() {
+    return Merge([](tree_type &shard) { return shard.begin(); });
+  }
+  cursor lower_bound(const Key &key) {
+    return Merge([&key](tree_type &shard) { return shard.lower_bound(key); });
+  }
+  cursor upper_bound(const Key &key) {
+    return Merge([&key](tree_type &shard) { return shard.upper_bound(key); });
+  }
+  // calls f(key, value) on every element with a key from lo to hi, both included, in order
+  template<class F>
+  void scan(const Key &lo, const Key &hi, F f) {
+    for (cursor now = lower_bound(lo); now.valid() && !(hi < now.key()); now.next()) {
+      f(now.key(), now.value());
+    }
+  }
+
+ private:
+  // a cursor merging what start gives for every shard
+  template<class F>
+  cursor Merge(F start) {
+    Wait();
+    cursor ret;
+    ret.parts = new typename cursor::shard_cursor[shard_num];
+    for (int i = 0; i < shard_num; ++i) {
+      ret.parts[i] = start(*shards[i]);
+    }
+    ret.start(shard_num);
+    return ret;
+  }
+};
+#endif //BPT__SHARDED_BPT_HPP_
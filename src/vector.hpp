@@ -25,7 +25,7 @@ class vector {
    * */
   void ChangeSize() {
     T *new_data = (T *) malloc((size_t) (2 * capacity) * sizeof(T));
-    for (int i = 0; i < current; ++i) {
+    for (size_t i = 0; i < current; ++i) {
       // new_data[i] = data[i];
       /* warning: we haven't used constructor upon the allocated memory
        * (and the object may lack default constructor)
@@ -262,7 +262,7 @@ class vector {
   }
   vector(const vector &other) : capacity(other.capacity), current(other.current) {
     data = (T *) malloc(capacity * sizeof(T));
-    for (int i = 0; i < current; ++i) {
+    for (size_t i = 0; i < current; ++i) {
       //data[i] = other[i];
       new(data + i) T(other[i]);
     }
@@ -271,7 +271,7 @@ class vector {
    * TODO Destructor
    */
   ~vector() {
-    for (int i = 0; i < current; ++i) {
+    for (size_t i = 0; i < current; ++i) {
       data[i].~T();
     }
     free(data);
@@ -281,13 +281,13 @@ class vector {
    */
   vector &operator=(const vector &other) {
     if (this == &other) return *this;
-    for (int i = 0; i < current; ++i) {
+    for (size_t i = 0; i < current; ++i) {
       data[i].~T();
     }
     free(data);
     capacity = other.capacity, current = other.current;
     data = (T *) malloc(other.capacity * sizeof(T));
-    for (int i = 0; i < current; ++i) {
+    for (size_t i = 0; i < current; ++i) {
       new(data + i) T(other[i]);
     }
     return *this;
@@ -297,11 +297,11 @@ class vector {
    * throw index_out_of_bound if pos is not in [0, size)
    */
   T &at(const size_t &pos) {
-    if (pos < 0 || pos >= current) throw index_out_of_bound();
+    if (pos >= current) throw index_out_of_bound();
     return data[pos];
   }
   const T &at(const size_t &pos) const {
-    if (pos < 0 || pos >= current) throw index_out_of_bound();
+    if (pos >= current) throw index_out_of_bound();
     return data[pos];
   }
   /**
@@ -311,11 +311,11 @@ class vector {
    *   In STL this operator does not check the boundary but I want you to do.
    */
   T &operator[](const size_t &pos) {
-    if (pos < 0 || pos >= current) throw index_out_of_bound();
+    if (pos >= current) throw index_out_of_bound();
     return data[pos];
   }
   const T &operator[](const size_t &pos) const {
-    if (pos < 0 || pos >= current) throw index_out_of_bound();
+    if (pos >= current) throw index_out_of_bound();
     return data[pos];
   }
   /**
@@ -368,7 +368,7 @@ class vector {
    * clears the contents
    */
   void clear() {
-    for (int i = 0; i < current; ++i) {
+    for (size_t i = 0; i < current; ++i) {
       data[i].~T();
     }
     current = 0;
@@ -412,7 +412,7 @@ class vector {
    */
   iterator erase(iterator pos) {
     data[pos.position].~T();
-    for (int i = pos.position; i < current - 1; ++i) {
+    for (size_t i = pos.position; i < current - 1; ++i) {
       data[i] = data[i + 1];
     }
     --current;
@@ -426,7 +426,7 @@ class vector {
   iterator erase(const size_t &ind) {
     if (ind >= size()) throw index_out_of_bound();
     data[ind].~T();
-    for (int i = ind; i < current - 1; ++i) {
+    for (size_t i = ind; i < current - 1; ++i) {
       data[i] = data[i + 1];
     }
     --current;
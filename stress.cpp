@@ -0,0 +1,242 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <iterator>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "src/bpt.hpp"
+#include "my_string.hpp"
+
+/*
+ * concurrent stress: threads insert, erase, find and walk a concurrent tree
+ * at once, each writing only the keys whose number leaves it as remainder,
+ * so that its own std::multimap says exactly what the tree holds for them
+ * whatever the others do; walks check that what they pass is in order, and
+ * agrees with the walker's own keys
+ * everything is checked once more when the threads are done and when the
+ * files are opened again; the first difference is printed and ends the run
+ * with 1 (built with -fsanitize=thread it checks the latching as well, given
+ * TSAN_OPTIONS=suppressions=tsan.supp)
+ * usage: stress [ops per thread] [threads] [seed]
+ */
+
+namespace fs = std::filesystem;
+
+const char *const stress_dir = "stress_files";
+const int stress_page_size = 1024;
+const int stress_keys = 4000;
+
+std::atomic<int> failures{0};
+
+void Fail(const char *name, const char *what, int thread) {
+  if (!failures++) {
+    printf("%s: %s differs in thread %d\n", name, what, thread);
+  }
+}
+
+template<class Key>
+Key MakeKey(int i);
+template<>
+my_string MakeKey<my_string>(int i) {
+  std::string ret = "k" + std::to_string(i);
+  if (i % 7 == 0) {
+    ret += std::string(40 + i % 20, (char) ('a' + i % 26));
+  }
+  return my_string(ret);
+}
+template<>
+int MakeKey<int>(int i) {
+  return i * 3 - 1000;
+}
+
+template<class Key>
+std::vector<int> Expect(const std::multimap<Key, int> &ref, const Key &key) {
+  std::vector<int> ret;
+  for (auto range = ref.equal_range(key); range.first != range.second; ++range.first) {
+    ret.push_back(range.first->second);
+  }
+  std::sort(ret.begin(), ret.end());
+  return ret;
+}
+std::vector<int> Got(const sjtu::vector<int> &found) {
+  std::vector<int> ret;
+  for (size_t i = 0; i < found.size(); ++i) {
+    ret.push_back(found[i]);
+  }
+  return ret;
+}
+
+template<class Key>
+struct stress_case {
+  typedef BPlusTree<Key, int, stress_page_size> tree_type;
+  const char *name;
+  long long budget;
+  bool logged;
+  int threads, ops, seed;
+  std::map<Key, int> number; // the key numbers, whose remainders say whose keys are whose
+
+  stress_case(const char *_name, long long _budget, bool _logged, int _threads, int _ops, int _seed)
+      : name(_name), budget(_budget), logged(_logged), threads(_threads), ops(_ops), seed(_seed) {}
+
+  tree_type *Open() {
+    std::string at = std::string(stress_dir) + "/";
+    return new tree_type(at + "tree", at + "data", false, budget, lru, logged ? at + "log" : "", false, false, true);
+  }
+
+  // what one thread does; ref ends up holding the elements of its keys
+  void Work(tree_type &tree, int me, std::multimap<Key, int> &ref) {
+    std::mt19937 rng(seed * 131 + me);
+    for (int i = 0; i < ops && !failures; ++i) {
+      int op = (int) (rng() % 20);
+      int mine = (int) (rng() % (stress_keys / threads)) * threads + me;
+      Key key = MakeKey<Key>(mine);
+      int value = (int) (rng() % 30);
+      if (op < 9) {
+        bool there = false;
+        for (auto range = ref.equal_range(key); range.first != range.second; ++range.first) {
+          there = there || range.first->second == value;
+        }
+        if (!there) {
+          ref.emplace(key, value);
+          tree.insert(key, value);
+        }
+      } else if (op < 15) {
+        for (auto range = ref.equal_range(key); range.first != range.second; ++range.first) {
+          if (range.first->second == value) {
+            ref.erase(range.first);
+            break;
+          }
+        }
+        tree.erase(key, value);
+      } else if (op < 18) {
+        if (Got(tree.find(key)) != Expect(ref, key)) {
+          Fail(name, "find", me);
+        }
+        tree.find(MakeKey<Key>((int) (rng() % stress_keys))); // somebody else's, being written meanwhile
+      } else if (op < 19) {
+        sjtu::vector<Key> batch;
+        for (int j = 0; j < 16; ++j) {
+          batch.push_back(MakeKey<Key>((int) (rng() % stress_keys)));
+        }
+        sjtu::vector<sjtu::vector<int>> found = tree.find_batch(batch);
+        for (int j = 0; j < 16; ++j) {
+          if (number.at(batch[j]) % threads == me && Got(found[j]) != Expect(ref, batch[j])) {
+            Fail(name, "find_batch", me);
+          }
+        }
+      } else {
+        Walk(tree, me, ref, MakeKey<Key>((int) (rng() % stress_keys)), rng() % 2);
+      }
+    }
+  }
+  // a walk of a hundred elements from key, forward or back
+  void Walk(tree_type &tree, int me, const std::multimap<Key, int> &ref, const Key &key, bool back) {
+    std::vector<std::pair<Key, int>> seen;
+    auto walk = back ? tree.floor(key) : tree.lower_bound(key);
+    for (int j = 0; j < 100 && walk.valid(); ++j) {
+      seen.emplace_back(walk.key(), walk.value());
+      if (back) {
+        walk.prev();
+      } else {
+        walk.next();
+      }
+    }
+    if (back) {
+      std::reverse(seen.begin(), seen.end());
+    }
+    for (size_t j = 1; j < seen.size(); ++j) {
+      if (!(seen[j - 1].first < seen[j].first)
+          && (seen[j].first < seen[j - 1].first || seen[j].second <= seen[j - 1].second)) {
+        Fail(name, "order of a walk", me);
+        return;
+      }
+    }
+    if (seen.size() < 2) {
+      return;
+    }
+    // between the first key seen and the last, every element of a key of mine is seen, and nothing else of mine
+    const Key &lo = seen.front().first, &hi = seen.back().first;
+    std::vector<std::pair<Key, int>> expect, got;
+    for (auto it = ref.upper_bound(lo); it != ref.end() && it->first < hi; ++it) {
+      for (int value : Expect(ref, it->first)) {
+        expect.emplace_back(it->first, value);
+      }
+      it = std::prev(ref.upper_bound(it->first));
+    }
+    for (auto &element : seen) {
+      if (lo < element.first && element.first < hi && number.at(element.first) % threads == me) {
+        got.push_back(element);
+      }
+    }
+    if (got != expect) {
+      Fail(name, "walk", me);
+    }
+  }
+  // the whole tree against every thread's elements
+  void CheckAll(tree_type &tree, const std::vector<std::multimap<Key, int>> &refs, const char *when) {
+    std::multimap<Key, int> all;
+    for (auto &ref : refs) {
+      all.insert(ref.begin(), ref.end());
+    }
+    for (int i = 0; i < stress_keys; ++i) {
+      Key key = MakeKey<Key>(i);
+      if (Got(tree.find(key)) != Expect(all, key)) {
+        Fail(name, when, -1);
+        return;
+      }
+    }
+    size_t count = 0;
+    for (auto walk = tree.begin(); walk.valid(); walk.next()) {
+      ++count;
+    }
+    if (count != all.size()) {
+      Fail(name, when, -1);
+    }
+  }
+
+  void Run() {
+    fs::remove_all(stress_dir);
+    fs::create_directory(stress_dir);
+    for (int i = 0; i < stress_keys; ++i) {
+      number[MakeKey<Key>(i)] = i;
+    }
+    std::vector<std::multimap<Key, int>> refs(threads);
+    tree_type *tree = Open();
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; ++i) {
+      workers.emplace_back([this, tree, i, &refs] { Work(*tree, i, refs[i]); });
+    }
+    for (auto &worker : workers) {
+      worker.join();
+    }
+    if (!failures) {
+      CheckAll(*tree, refs, "after the threads");
+    }
+    delete tree;
+    if (!failures) {
+      tree = Open();
+      CheckAll(*tree, refs, "after opening again");
+      delete tree;
+    }
+    fs::remove_all(stress_dir);
+  }
+};
+
+int main(int argc, char **argv) {
+  int ops = argc > 1 ? atoi(argv[1]) : 20000;
+  int threads = argc > 2 ? std::max(1, atoi(argv[2])) : 4;
+  int seed = argc > 3 ? atoi(argv[3]) : 1;
+  stress_case<my_string>("strings", 512 << 10, false, threads, ops, seed).Run(); // two partitions of the cache
+  stress_case<my_string>("strings with log", 512 << 10, true, threads, ops, seed).Run();
+  stress_case<int>("integers", 64 << 10, false, threads, ops, seed).Run();
+  if (failures) {
+    return 1;
+  }
+  puts("ok");
+  return 0;
+}
@@ -1,167 +1,867 @@
 #ifndef BPT__CACHELIST_HPP_
 #define BPT__CACHELIST_HPP_
 
-#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <iostream>
+#include <mutex>
+#include <new>
+#include <thread>
+#include "PageFile.hpp"
+#include "PageMap.hpp"
 
-using std::pair;
 /*
  * @class CacheList
- * this is a simulation of the LRU policy, using a hashmap and a linklist to save the
- * recently-used block, which can boost efficiency (especially during find)
+ * a buffer pool of pinned frames, using a hashmap and linklists to locate the
+ * recently-used blocks
+ * a block is used in place: Pin hands out a handle to the frame itself, so a hit
+ * neither allocates nor copies anything; the frame stays put until every handle
+ * to it is gone, and it is written back only if some handle marked it dirty
+ * frames are aligned to direct_alignment, so files opened direct move them as they are
+ * blocks of every attached file share one budget counted in bytes, so whichever
+ * kind of block is hot gets the memory
+ *
+ * the pool is split into partitions by page number, each with a latch, a map,
+ * lists and a part of the budget of its own, so threads pinning different
+ * blocks seldom wait for each other; a run of partition_run pages lies in one
+ * partition, which keeps adjacent blocks together for write-back
+ * no latch is held while a block is read or written: the frame is marked busy
+ * meanwhile, and whoever pins it waits for that alone
+ * blocks lying next to each other can be read ahead together (see Prefetch),
+ * one preadv for them all
+ * a block can also be kept (see Keep): its frame is never given up, and
+ * Resident finds it by page number through atomics alone, with no latch, pin
+ * or move in the lists
+ *
+ * which frame to give up is decided by one of the policies below, in each
+ * partition on its own:
+ *   lru        - the least recently used one; a long scan flushes everything
+ *   clock      - second chance around a ring; a hit only sets a bit
+ *   two_queue  - 2Q: a block seen once waits in a FIFO of a quarter of the budget
+ *                and only goes to the LRU part when it is touched again (or comes
+ *                back soon after being evicted), so scans cannot push hot blocks out
+ *
+ * optionally a flusher thread writes dirty frames in the background (see StartFlusher),
+ * so that the frames eviction meets are mostly clean and shutdown has little left to do
+ * with HoldDirty on, dirty frames are never evicted: blocks reach their files only
+ * through Flush, which is what a write-ahead log checkpointing the files needs
  */
-const int max_cache = 3000;
-const int map_size = 23475;
-const int mod = 23473;
-int rehash[20] = {1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384};
+enum CachePolicy { lru, clock_sweep, two_queue };
+
+const long long default_budget = 96LL << 20;
+const int max_files = 8;
+const int flush_batch = 64; // frames the flusher copies out per round
+const int flush_poll = 50; // ms between two looks at the dirty ratio
+const int max_partitions = 16;
+const long long partition_bytes = 256LL << 10; // the least budget worth a partition of its own
+const int partition_run = 8; // adjacent pages going to the same partition
+const int kept_chunk_bits = 12; // kept blocks are found through chunks of 1 << kept_chunk_bits pages
+const int kept_chunks = 1 << 16;
+
+struct CacheStats {
+  long long hits = 0, misses = 0;
+  double HitRate() const {
+    return hits + misses ? (double) hits / (double) (hits + misses) : 0;
+  }
+};
 
-template<class T>
 class CachePool {
  private:
-  struct cache_node {
-    int address = 0;
-    T data;
-    cache_node *prev = nullptr, *next = nullptr;
-    cache_node(int address_ = 0,
-               cache_node *prev_ = nullptr,
-               cache_node *next_ = nullptr)
-        : address(address_), prev(prev_), next(next_) {}
-  };
-  class cache {
-   public:
-   private:
+  enum Queue { main_queue, in_queue, ghost_queue };
+  struct frame {
+    long long id = -1; // file index in the high bits, page number in the low ones
     int size = 0;
-    std::fstream &out;
-   public:
-    cache_node *head, *tail;
-    explicit cache(std::fstream &out_) : out(out_), size(0) {
-      head = new cache_node(), tail = new cache_node();
+    std::atomic<int> pin{0}; // number of live handles (plus the flusher while writing)
+    std::atomic<bool> dirty{false};
+    bool used = false; // reference bit of clock_sweep
+    bool busy = false; // being read or written back without the latch, and pinned meanwhile
+    bool kept = false; // never given up (see Keep)
+    Queue queue = main_queue;
+    char *data = nullptr; // nullptr for ghosts, which only remember an id
+    frame *prev = nullptr, *next = nullptr;
+  };
+  // a doubly linked list with sentinels, the front is the newest
+  struct chain {
+    frame *head, *tail;
+    long long bytes = 0;
+    int num = 0;
+    chain() {
+      head = new frame, tail = new frame;
       head->next = tail, tail->prev = head;
     }
-    ~cache() {
-      size = 0;
-      cache_node *now = head->next;
+    ~chain() {
+      frame *now = head->next;
       while (now != tail) {
-        cache_node *temp = now;
+        frame *temp = now;
         now = now->next;
-        if (temp->data.changed && temp->address != 0) {
-          temp->data.changed = false;
-          out.seekp(temp->address);
-          out.write(reinterpret_cast<char *>(&temp->data), sizeof(temp->data));
-        }
+        DeleteAligned(temp->data);
         delete temp;
       }
-      out.close();
-      delete now, delete head;
+      delete head, delete tail;
     }
-
-    void erase(cache_node *todo) {
+    void insert(frame *todo, frame *after) {
+      todo->prev = after;
+      todo->next = after->next;
+      after->next->prev = todo;
+      after->next = todo;
+      bytes += todo->size, ++num;
+    }
+    void push_front(frame *todo) {
+      insert(todo, head);
+    }
+    void unlink(frame *todo) {
       todo->prev->next = todo->next;
       todo->next->prev = todo->prev;
-      delete todo;
-      --size;
+      bytes -= todo->size, --num;
+    }
+  };
+  // the frames of some of the pages, and everything about them
+  struct partition {
+    std::mutex latch; // guards everything below, and the frames in here but their atomics
+    std::condition_variable settled; // a frame stopped being busy
+    long long budget = 0, used = 0; // bytes
+    CacheStats stats;
+    chain main_chain; // everything under lru and clock_sweep, the LRU part of two_queue
+    chain in_chain, ghost_chain; // two_queue only
+    frame *hand = nullptr; // clock_sweep: the next frame to look at
+    PageMap<frame> storage; // every frame and ghost by id
+  };
+ public:
+  /*
+   * @class handle
+   * a pinned block, released on destruction
+   * a handle can also wrap memory the pool does not own (e.g. a mapped page),
+   * in which case pinning and dirty marks are no-ops
+   */
+  template<class T>
+  class handle {
+    friend class CachePool;
+   private:
+    CachePool *pool = nullptr;
+    frame *block = nullptr;
+    T *data = nullptr;
+    handle(CachePool *pool_, frame *block_)
+        : pool(pool_), block(block_), data(reinterpret_cast<T *>(block_->data)) {}
+   public:
+    handle() = default;
+    explicit handle(T *data_) : data(data_) {}
+    handle(const handle &) = delete;
+    handle &operator=(const handle &) = delete;
+    handle(handle &&other) noexcept : pool(other.pool), block(other.block), data(other.data) {
+      other.pool = nullptr, other.block = nullptr, other.data = nullptr;
+    }
+    handle &operator=(handle &&other) noexcept {
+      if (this != &other) {
+        Release();
+        pool = other.pool, block = other.block, data = other.data;
+        other.pool = nullptr, other.block = nullptr, other.data = nullptr;
+      }
+      return *this;
+    }
+    ~handle() {
+      Release();
+    }
+    T *operator->() const {
+      return data;
     }
+    T &operator*() const {
+      return *data;
+    }
+    explicit operator bool() const {
+      return data != nullptr;
+    }
+    void Dirty() {
+      if (block && !block->dirty.exchange(true)) {
+        pool->dirtied(block->size);
+      }
+    }
+    void Release() {
+      if (block) {
+        --block->pin;
+      }
+      pool = nullptr, block = nullptr, data = nullptr;
+    }
+  };
+
+ private:
+  long long budget; // bytes, split evenly among the partitions
+  std::atomic<long long> dirty_bytes{0};
+  CachePolicy policy;
+  PageFile *files[max_files] = {nullptr};
+  int file_num = 0;
+  partition *parts;
+  int part_num;
+  std::atomic<bool> hold_dirty{false};
+  // the data of kept frames by file and page, in chunks allocated the first time one of their pages is kept
+  typedef std::atomic<char *> kept_slot;
+  std::atomic<std::atomic<kept_slot *> *> kept_pages[max_files];
+  std::mutex keep_latch; // guards the allocation of kept_pages
+  // the flusher
+  std::thread flusher;
+  std::mutex flush_latch; // guards stopping, for wake
+  std::condition_variable wake;
+  bool stopping = false;
+  double dirty_ratio = 1;
+  int checkpoint_ms = 0;
 
-    void pop_back() {
-      cache_node *todo = tail->prev;
-      if (todo->data.changed) {
-        todo->data.changed = false;
-        out.seekp(todo->address);
-        out.write(reinterpret_cast<char *>(&todo->data), sizeof(todo->data));
+  static long long make_id(int file, long long page) {
+    return (long long) file << 56 | page;
+  }
+  static int file_of(long long id) {
+    return (int) (id >> 56);
+  }
+  static long long page_of(long long id) {
+    return id & ((1LL << 56) - 1);
+  }
+
+  partition &part_of(long long id) const {
+    return parts[(page_of(id) / partition_run + file_of(id)) % part_num];
+  }
+
+  void dirtied(int size) {
+    if ((dirty_bytes += size) > dirty_ratio * budget && flusher.joinable()) {
+      wake.notify_one();
+    }
+  }
+
+  // clears the dirty mark, true if it was set
+  bool clean(frame *todo) {
+    if (todo->dirty.exchange(false)) {
+      dirty_bytes -= todo->size;
+      return true;
+    }
+    return false;
+  }
+
+  static chain &chain_of(partition &part, frame *todo) {
+    return todo->queue == main_queue ? part.main_chain : todo->queue == in_queue ? part.in_chain : part.ghost_chain;
+  }
+
+  static void unlink(partition &part, frame *todo) {
+    if (todo == part.hand) {
+      step_hand(part);
+      if (todo == part.hand) { // the only frame left
+        part.hand = nullptr;
       }
-      todo->prev->next = tail;
-      tail->prev = todo->prev;
-      delete todo;
-      --size;
     }
+    chain_of(part, todo).unlink(todo);
+  }
+
+  static void step_hand(partition &part) {
+    part.hand = part.hand->prev;
+    if (part.hand == part.main_chain.head) {
+      part.hand = part.main_chain.tail->prev;
+    }
+  }
+
+  // takes a clean unpinned frame out of the pool
+  void evict(partition &part, frame *todo) {
+    if (todo->id != -1) { // discarded frames are no longer in the map
+      part.storage.Erase(todo->id);
+    }
+    unlink(part, todo);
+    part.used -= todo->size;
+  }
 
-    std::pair<cache_node *, bool> push_front(const T &val) {
-      auto *todo = new cache_node(val.address);
-      todo->data = val;
-      todo->prev = head;
-      head->next->prev = todo;
-      todo->next = head->next;
-      head->next = todo;
-      ++size;
-      if (size == max_cache) {
-        return std::make_pair(todo, false);
+  /*
+   * writes the dirty frame todo back, letting go of the latch meanwhile; the
+   * frame is busy and pinned until it is done, so nobody changes or evicts it
+   */
+  void write_back(partition &part, std::unique_lock<std::mutex> &lock, frame *todo) {
+    clean(todo);
+    ++todo->pin, todo->busy = true;
+    lock.unlock();
+    try {
+      files[file_of(todo->id)]->Write(page_of(todo->id) * todo->size, todo->data, todo->size);
+    } catch (...) {
+      lock.lock();
+      if (!todo->dirty.exchange(true)) {
+        dirty_bytes += todo->size;
       }
-      return std::make_pair(todo, true);
+      settle(part, todo);
+      throw;
     }
-  };
-  cache block_pool;
-  cache_node *storage[map_size] = {nullptr};
-  pair<cache_node *, int> find(int id) {
-    int pos = id % mod;
-    int cnt = 0;
-    while (pos < map_size) {
-      if (storage[pos] && storage[pos]->address == id) {
-        return pair<cache_node *, int>(storage[pos], pos);
-      } else {
-        pos += rehash[cnt];
-        ++cnt;
+    lock.lock();
+    settle(part, todo);
+  }
+  // the transfer on a busy frame is over
+  static void settle(partition &part, frame *todo) {
+    todo->busy = false, --todo->pin;
+    part.settled.notify_all();
+  }
+  // waits, pinned, until the frame is not busy; false if it no longer holds id then
+  static bool wait_settled(partition &part, std::unique_lock<std::mutex> &lock, frame *todo, long long id) {
+    ++todo->pin;
+    part.settled.wait(lock, [todo] { return !todo->busy; });
+    --todo->pin;
+    return todo->id == id;
+  }
+
+  // pinned, kept, or dirty while dirty frames are held
+  bool held(frame *todo) const {
+    return todo->pin || todo->kept || (hold_dirty && todo->dirty);
+  }
+
+  // the oldest frame of a chain not held (a clean one if there is one near the end),
+  // nullptr if all of them are held
+  frame *oldest(chain &from) const {
+    frame *ret = nullptr;
+    int look = 0;
+    for (frame *now = from.tail->prev; now != from.head && look < flush_batch; now = now->prev) {
+      if (!held(now)) {
+        if (!now->dirty) {
+          return now;
+        }
+        if (!ret) {
+          ret = now;
+        }
+        ++look;
       }
     }
-    return pair<cache_node *, int>(nullptr, -1);
+    for (frame *now = from.tail->prev; !ret && now != from.head; now = now->prev) {
+      if (!held(now)) {
+        ret = now;
+      }
+    }
+    return ret;
   }
 
-  int find_valid(int id) {
-    int pos = id % mod, cnt = 0;
-    while (pos < map_size) {
-      if (storage[pos]) {
-        pos += rehash[cnt];
-        ++cnt;
+  // the frame the policy would give up next, nullptr if every frame is held
+  frame *choose(partition &part) {
+    if (policy == clock_sweep) {
+      // two rounds clear every reference bit, so a third one would be pointless
+      for (int i = 0; part.hand && i < 2 * part.main_chain.num + 1; ++i) {
+        frame *now = part.hand;
+        step_hand(part);
+        if (held(now)) {
+          continue;
+        }
+        if (now->used) {
+          now->used = false;
+        } else {
+          return now;
+        }
+      }
+      return nullptr;
+    }
+    if (policy == two_queue) {
+      frame *ret = nullptr;
+      if (part.in_chain.bytes > part.budget / 4) {
+        ret = oldest(part.in_chain);
+      }
+      if (!ret) {
+        ret = oldest(part.main_chain);
+      }
+      return ret ? ret : oldest(part.in_chain);
+    }
+    return oldest(part.main_chain);
+  }
+
+  // two_queue remembers blocks evicted from the FIFO for a while
+  static void remember(partition &part, long long id) {
+    auto *ghost = new frame;
+    ghost->id = id, ghost->queue = ghost_queue;
+    part.ghost_chain.push_front(ghost);
+    part.storage.Insert(id, ghost);
+    if (part.ghost_chain.num > part.main_chain.num + part.in_chain.num) {
+      forget(part, part.ghost_chain.tail->prev);
+    }
+  }
+
+  static void forget(partition &part, frame *ghost) {
+    part.storage.Erase(ghost->id);
+    part.ghost_chain.unlink(ghost);
+    delete ghost;
+  }
+
+  /*
+   * a frame of size bytes ready to hold a new block
+   * clean frames are evicted until the new block fits in the budget; one of
+   * them is reused if it has the right size, the rest are freed
+   * a dirty frame in the way is handed back in dirty instead, with nullptr:
+   * it is to be written back first (see write_back)
+   * when every frame is held the pool goes past the budget rather than fail
+   */
+  frame *victim(partition &part, int size, frame *&dirty) {
+    frame *reuse = nullptr;
+    while (part.used + size > part.budget) {
+      frame *todo = choose(part);
+      if (!todo) {
+        break;
+      }
+      if (todo->dirty) {
+        if (reuse) {
+          DeleteAligned(reuse->data);
+          delete reuse;
+        }
+        dirty = todo;
+        return nullptr;
+      }
+      bool first_seen = todo->queue == in_queue && todo->id != -1;
+      long long id = todo->id;
+      evict(part, todo);
+      if (first_seen) {
+        remember(part, id);
+      }
+      if (!reuse && todo->size == size) {
+        reuse = todo;
       } else {
-        return pos;
+        DeleteAligned(todo->data);
+        delete todo;
       }
     }
-    return -1;
+    if (!reuse) {
+      reuse = new frame;
+      reuse->size = size, reuse->data = NewAligned(size);
+    }
+    part.used += size;
+    return reuse;
   }
 
-  int find_place(int id) {
-    int pos = id % mod, cnt = 0;
-    while (pos < map_size) {
-      if (storage[pos] && storage[pos]->address == id) {
-        return pos;
+  // a frame for id, put in the map; nullptr, with dirty set, as for victim
+  frame *place(partition &part, long long id, int size, frame *&dirty) {
+    frame *todo = victim(part, size, dirty);
+    if (!todo) {
+      return nullptr;
+    }
+    Queue queue = main_queue;
+    if (policy == two_queue) {
+      frame *ghost = part.storage.Find(id);
+      if (ghost) { // evicted not long ago: it deserves the LRU part
+        forget(part, ghost);
       } else {
-        pos += rehash[cnt];
-        ++cnt;
+        queue = in_queue;
       }
     }
-    return -1;
+    todo->id = id, todo->pin = 0, todo->dirty = false, todo->used = false, todo->busy = false;
+    todo->queue = queue;
+    if (policy == clock_sweep && part.hand) {
+      part.main_chain.insert(todo, part.hand); // right behind the hand: the last one it reaches
+    } else {
+      chain_of(part, todo).push_front(todo);
+      if (policy == clock_sweep) {
+        part.hand = todo;
+      }
+    }
+    part.storage.Insert(id, todo);
+    return todo;
+  }
+
+  void touch(partition &part, frame *todo) {
+    if (policy == clock_sweep) {
+      todo->used = true;
+    } else if (todo->queue == main_queue) {
+      part.main_chain.unlink(todo), part.main_chain.push_front(todo);
+    } // a second touch inside the FIFO of two_queue does not count
   }
 
-  void erase_last() {
-    cache_node *todo = block_pool.tail->prev;
-    if (!todo) return;
-    storage[find_place(todo->address)] = nullptr;
-    block_pool.pop_back();
+  /*
+   * writes dirty unpinned frames of part (pinned ones too with pinned) until
+   * no more than target bytes are dirty in the whole pool, taking the coldest
+   * ones first and every batch in page order
+   * a batch is copied out under the latch and written without it; the frames
+   * stay pinned meanwhile, so none of them can be evicted (and written again)
+   * before the copy taken here reaches the file
+   */
+  void write_dirty(partition &part, std::unique_lock<std::mutex> &lock, long long target, bool pinned = false) {
+    frame *batch[flush_batch];
+    char *copy[flush_batch] = {nullptr};
+    int copy_size[flush_batch] = {0};
+    const void *run[flush_batch];
+    while (dirty_bytes > target) {
+      int num = 0;
+      for (chain *from : {&part.in_chain, &part.main_chain}) {
+        for (frame *now = from->tail->prev; now != from->head && num < flush_batch; now = now->prev) {
+          if (now->dirty && (pinned || !now->pin)) {
+            batch[num++] = now;
+          }
+        }
+      }
+      if (!num) {
+        break;
+      }
+      std::sort(batch, batch + num, [](frame *a, frame *b) { return a->id < b->id; });
+      long long id[flush_batch];
+      for (int i = 0; i < num; ++i) {
+        if (copy_size[i] < batch[i]->size) {
+          DeleteAligned(copy[i]);
+          copy[i] = NewAligned(batch[i]->size), copy_size[i] = batch[i]->size;
+        }
+        memcpy(copy[i], batch[i]->data, batch[i]->size);
+        clean(batch[i]);
+        ++batch[i]->pin;
+        id[i] = batch[i]->id;
+      }
+      lock.unlock();
+      for (int i = 0, j; i < num; i = j) {
+        for (j = i; j < num && batch[j]->size == batch[i]->size
+            && id[j] == id[i] + (j - i); ++j) {
+          run[j - i] = copy[j];
+        }
+        files[file_of(id[i])]->WritePages(page_of(id[i]) * batch[i]->size, run, j - i, batch[i]->size);
+      }
+      lock.lock();
+      for (int i = 0; i < num; ++i) {
+        --batch[i]->pin;
+      }
+    }
+    for (int i = 0; i < flush_batch; ++i) {
+      DeleteAligned(copy[i]);
+    }
+  }
+  // the same over every partition, one after another
+  void write_dirty(long long target, bool pinned = false) {
+    for (int i = 0; i < part_num && dirty_bytes > target; ++i) {
+      std::unique_lock<std::mutex> lock(parts[i].latch);
+      write_dirty(parts[i], lock, target, pinned);
+    }
   }
 
-  void Delete(cache_node *todo) {
-    storage[find_place(todo->address)] = nullptr;
-    block_pool.erase(todo);
+  void flush_loop() {
+    std::unique_lock<std::mutex> lock(flush_latch);
+    auto checkpoint = std::chrono::steady_clock::now() + std::chrono::milliseconds(checkpoint_ms);
+    while (!stopping) {
+      auto poll = std::chrono::steady_clock::now() + std::chrono::milliseconds(flush_poll);
+      wake.wait_until(lock, checkpoint_ms ? std::min(poll, checkpoint) : poll);
+      if (stopping) {
+        break;
+      }
+      lock.unlock();
+      if (checkpoint_ms && std::chrono::steady_clock::now() >= checkpoint) {
+        write_dirty(0);
+        checkpoint = std::chrono::steady_clock::now() + std::chrono::milliseconds(checkpoint_ms);
+      } else if (dirty_bytes > dirty_ratio * budget) {
+        write_dirty((long long) (dirty_ratio * budget / 2));
+      }
+      lock.lock();
+    }
   }
+
  public:
-  CachePool(std::fstream &out_) : block_pool(out_) {}
-  bool GetNode(T &todo, int id) {
-    // std::cout << id << '\n';
-    cache_node *search = find(id).first;
+  explicit CachePool(long long budget_ = default_budget, CachePolicy policy_ = lru)
+      : budget(budget_), policy(policy_) {
+    part_num = 1;
+    while (part_num < max_partitions && budget / (2 * part_num) >= partition_bytes) {
+      part_num *= 2;
+    }
+    parts = new partition[part_num];
+    for (int i = 0; i < part_num; ++i) {
+      parts[i].budget = budget / part_num;
+    }
+    for (int i = 0; i < max_files; ++i) {
+      kept_pages[i] = nullptr;
+    }
+  }
+  CachePool(const CachePool &) = delete;
+  CachePool &operator=(const CachePool &) = delete;
+  ~CachePool() {
+    StopFlusher();
+    Flush();
+    delete[] parts;
+    for (int i = 0; i < max_files; ++i) {
+      std::atomic<kept_slot *> *chunks = kept_pages[i];
+      for (int j = 0; chunks && j < kept_chunks; ++j) {
+        delete[] chunks[j].load();
+      }
+      delete[] chunks;
+    }
+  }
+
+  // lets the pool cache blocks of file, which is then referred to by the returned index; before any Pin
+  int Attach(PageFile &file) {
+    files[file_num] = &file;
+    return file_num++;
+  }
+
+  /*
+   * starts the flusher: once more than dirty_ratio of the budget is dirty it writes
+   * the coldest dirty frames until half of that is left, and every checkpoint
+   * milliseconds (if not 0) it writes all of them
+   */
+  void StartFlusher(double dirty_ratio_, int checkpoint_ms_) {
+    StopFlusher();
+    dirty_ratio = dirty_ratio_, checkpoint_ms = checkpoint_ms_;
+    stopping = false;
+    flusher = std::thread(&CachePool::flush_loop, this);
+  }
+
+  void StopFlusher() {
+    if (flusher.joinable()) {
+      {
+        std::lock_guard<std::mutex> guard(flush_latch);
+        stopping = true;
+      }
+      wake.notify_one();
+      flusher.join();
+    }
+  }
+
+  /*
+   * the block at page of file, read from the file on a miss
+   * a file holds blocks of one size, page number p lying at byte p * sizeof(T)
+   */
+  template<class T>
+  handle<T> Pin(int file, long long page) {
+    long long id = make_id(file, page);
+    partition &part = part_of(id);
+    std::unique_lock<std::mutex> lock(part.latch);
+    while (true) {
+      frame *search = part.storage.Find(id);
+      if (search && search->data) {
+        if (search->busy && !wait_settled(part, lock, search, id)) {
+          continue; // the read failed
+        }
+        ++part.stats.hits;
+        touch(part, search);
+        ++search->pin;
+        return handle<T>(this, search);
+      }
+      frame *dirty = nullptr;
+      search = place(part, id, sizeof(T), dirty);
+      if (!search) {
+        write_back(part, lock, dirty);
+        continue;
+      }
+      ++part.stats.misses;
+      ++search->pin, search->busy = true;
+      lock.unlock();
+      try {
+        files[file]->Read(page * (long long) sizeof(T), search->data, sizeof(T));
+      } catch (...) {
+        lock.lock();
+        drop(part, search);
+        settle(part, search);
+        throw;
+      }
+      lock.lock();
+      settle(part, search);
+      ++search->pin;
+      return handle<T>(this, search);
+    }
+  }
+
+  /*
+   * reads ahead the blocks of the run of partition_run pages that page lies in,
+   * those not in the pool and not past the end of the file, with one preadv per
+   * stretch of adjacent ones; they are left clean and unpinned, so pins of them
+   * then hit (each read counts as a miss)
+   * it stops early rather than write a dirty frame back to make room
+   */
+  template<class T>
+  void Prefetch(int file, long long page) {
+    long long first = page / partition_run * partition_run;
+    long long end = std::min(first + partition_run, files[file]->Size() / (long long) sizeof(T));
+    partition &part = part_of(make_id(file, first));
+    frame *read[partition_run];
+    int num = 0;
+    std::unique_lock<std::mutex> lock(part.latch);
+    for (long long now = first; now < end; ++now) {
+      long long id = make_id(file, now);
+      frame *search = part.storage.Find(id);
+      if (search && search->data) {
+        continue;
+      }
+      frame *dirty = nullptr;
+      if (!(search = place(part, id, sizeof(T), dirty))) {
+        break;
+      }
+      ++part.stats.misses;
+      ++search->pin, search->busy = true;
+      read[num++] = search;
+    }
+    lock.unlock();
+    try {
+      void *run[partition_run];
+      for (int i = 0, j; i < num; i = j) {
+        for (j = i; j < num && read[j]->id == read[i]->id + (j - i); ++j) {
+          run[j - i] = read[j]->data;
+        }
+        files[file]->ReadPages(page_of(read[i]->id) * (long long) sizeof(T), run, j - i, sizeof(T));
+      }
+    } catch (...) {
+      lock.lock();
+      for (int i = 0; i < num; ++i) {
+        drop(part, read[i]);
+        settle(part, read[i]);
+      }
+      throw;
+    }
+    lock.lock();
+    for (int i = 0; i < num; ++i) {
+      settle(part, read[i]);
+    }
+  }
+
+  // a brand-new block at page of file, default constructed and already dirty
+  template<class T>
+  handle<T> Create(int file, long long page) {
+    long long id = make_id(file, page);
+    partition &part = part_of(id);
+    std::unique_lock<std::mutex> lock(part.latch);
+    while (true) {
+      frame *search = part.storage.Find(id);
+      if (search && search->busy) {
+        wait_settled(part, lock, search, id);
+        continue;
+      }
+      if (search && (!search->data || search->size != (int) sizeof(T))) {
+        discard(part, search);
+        search = nullptr;
+      }
+      if (search) {
+        touch(part, search);
+      } else {
+        frame *dirty = nullptr;
+        search = place(part, id, sizeof(T), dirty);
+        if (!search) {
+          write_back(part, lock, dirty);
+          continue;
+        }
+      }
+      new(search->data) T();
+      ++search->pin;
+      handle<T> ret(this, search);
+      ret.Dirty();
+      return ret;
+    }
+  }
+
+  /*
+   * keeps the block of a handle of this pool in memory for as long as the pool
+   * lives, for Resident to find; it goes on counting against the budget, and
+   * is written back like any other, but never evicted nor discarded, so a
+   * page coming back is put in the same frame
+   * blocks past kept_chunks << kept_chunk_bits pages are not kept
+   */
+  template<class T>
+  void Keep(const handle<T> &pinned) {
+    frame *block = pinned.block;
+    if (!block || page_of(block->id) >> kept_chunk_bits >= kept_chunks) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> guard(part_of(block->id).latch);
+      if (block->kept) {
+        return;
+      }
+      block->kept = true;
+    }
+    int file = file_of(block->id);
+    long long page = page_of(block->id);
+    std::lock_guard<std::mutex> guard(keep_latch);
+    if (!kept_pages[file]) {
+      kept_pages[file] = new std::atomic<kept_slot *>[kept_chunks]();
+    }
+    std::atomic<kept_slot *> &chunk = kept_pages[file][page >> kept_chunk_bits];
+    if (!chunk) {
+      chunk = new kept_slot[1 << kept_chunk_bits]();
+    }
+    chunk.load()[page & ((1 << kept_chunk_bits) - 1)].store(block->data, std::memory_order_release);
+  }
+  /*
+   * the block at page of file if it is kept, nullptr otherwise, without any
+   * latch: it may be changing meanwhile, so the caller must be able to tell a
+   * torn read (as optimistic readers of a tree do)
+   */
+  template<class T>
+  const T *Resident(int file, long long page) const {
+    std::atomic<kept_slot *> *chunks = kept_pages[file].load(std::memory_order_acquire);
+    if (!chunks || page >> kept_chunk_bits >= kept_chunks) {
+      return nullptr;
+    }
+    kept_slot *chunk = chunks[page >> kept_chunk_bits].load(std::memory_order_acquire);
+    if (!chunk) {
+      return nullptr;
+    }
+    return reinterpret_cast<const T *>(chunk[page & ((1 << kept_chunk_bits) - 1)].load(std::memory_order_acquire));
+  }
+
+  // forgets the block at page of file without writing it; it must not be pinned
+  void Discard(int file, long long page) {
+    long long id = make_id(file, page);
+    partition &part = part_of(id);
+    std::lock_guard<std::mutex> guard(part.latch);
+    frame *search = part.storage.Find(id);
     if (search) {
-      todo = search->data;
-      Delete(search);
-      return true;
-    } else {
-      return false;
+      discard(part, search);
     }
   }
-  void InsertFront(const T &value) {
-    auto res = block_pool.push_front(value);
-    if (!res.second) {
-      erase_last();
+
+  /*
+   * writes every dirty block back, in page order, one pwritev per run of adjacent blocks
+   * pinned blocks are left for later unless pinned is set, which is only safe
+   * when none of them changes meanwhile
+   */
+  void Flush(bool pinned = false) {
+    write_dirty(0, pinned);
+  }
+
+  // with hold set, dirty blocks stay in memory until the next Flush
+  void HoldDirty(bool hold) {
+    hold_dirty = hold;
+  }
+
+  // calls f(file, page, data, size) on every dirty block, which must not change meanwhile
+  template<class F>
+  void ForEachDirty(F f) {
+    for (int i = 0; i < part_num; ++i) {
+      std::lock_guard<std::mutex> guard(parts[i].latch);
+      for (chain *from : {&parts[i].in_chain, &parts[i].main_chain}) {
+        for (frame *now = from->head->next; now != from->tail; now = now->next) {
+          if (now->dirty && now->id != -1) {
+            f(file_of(now->id), page_of(now->id), now->data, now->size);
+          }
+        }
+      }
+    }
+  }
+
+  long long Budget() const {
+    return budget;
+  }
+  long long DirtyBytes() const {
+    return dirty_bytes;
+  }
+
+  CacheStats Stats() const {
+    CacheStats ret;
+    for (int i = 0; i < part_num; ++i) {
+      std::lock_guard<std::mutex> guard(parts[i].latch);
+      ret.hits += parts[i].stats.hits, ret.misses += parts[i].stats.misses;
+    }
+    return ret;
+  }
+
+  void ResetStats() {
+    for (int i = 0; i < part_num; ++i) {
+      std::lock_guard<std::mutex> guard(parts[i].latch);
+      parts[i].stats = CacheStats();
     }
-    storage[find_valid(value.address)] = res.first;
   }
 
+ private:
+  void discard(partition &part, frame *search) {
+    if (!search->data) {
+      forget(part, search);
+    } else if (!search->pin && !search->kept) {
+      clean(search);
+      drop(part, search);
+    }
+  }
+  // takes the frame out of the map, to be the first one reused
+  void drop(partition &part, frame *search) {
+    part.storage.Erase(search->id);
+    search->id = -1;
+    if (policy == clock_sweep) {
+      search->used = false;
+      part.hand = search;
+    } else {
+      chain &from = chain_of(part, search);
+      from.unlink(search);
+      from.insert(search, from.tail->prev);
+    }
+  }
 };
-#endif //BPT__CACHELIST_HPP_
\ No newline at end of file
+#endif //BPT__CACHELIST_HPP_
@@ -0,0 +1,160 @@
+#ifndef BPT__EXTERNALSORT_HPP_
+#define BPT__EXTERNALSORT_HPP_
+
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include "PageFile.hpp"
+
+const int merge_buffer = 1 << 16; // bytes read at a time from each run while merging
+const int spill_chunk = 1 << 30; // bytes of a run written at a time
+const int first_run = 1 << 10; // values the run being gathered first has room for
+
+/*
+ * @class ExternalSort
+ * sorts more values than memory holds: Add gathers them into a run of run_bytes,
+ * which is sorted and appended to a file ("<name>'s runs") once full; Next
+ * then hands all of them back in order, merging the runs through a heap, each
+ * read sequentially a buffer at a time
+ * values that fit in a single run never reach the file; the run grows as they
+ * come, so a few of them take little memory whatever run_bytes is
+ * values are stored as their raw bytes; the file goes away with the object
+ */
+template<class V, class Less = std::less<V>>
+class ExternalSort {
+ private:
+  struct run {
+    long long place, end; // the next value of the run in the file, and where it ends
+    int at = 0, count = 0; // within its buffer
+  };
+  std::string name;
+  PageFile file;
+  Less less;
+  V *values = nullptr; // the run being gathered, then the buffers of the runs one after another
+  long long capacity, count = 0, spilled = 0; // values a run holds, gathered, in the file
+  long long room = 0; // values the run being gathered has room for so far
+  long long handed = 0; // values handed out when there is a single run
+  long long *starts = nullptr; // where each run begins in the file, in values
+  int runs = 0, starts_capacity = 0;
+  bool merging = false;
+  run *cursors = nullptr;
+  int *heap = nullptr, heap_size = 0, per_run = 0;
+
+  void spill() {
+    std::sort(values, values + count, less);
+    if (!runs) {
+      file.Open(name);
+    }
+    if (runs == starts_capacity) {
+      starts_capacity = starts_capacity ? 2 * starts_capacity : 16;
+      auto *grown = new long long[starts_capacity];
+      std::copy(starts, starts + runs, grown);
+      delete[] starts;
+      starts = grown;
+    }
+    starts[runs++] = spilled;
+    const char *from = reinterpret_cast<const char *>(values);
+    for (long long done = 0, total = count * (long long) sizeof(V); done < total; done += spill_chunk) {
+      file.Write(spilled * (long long) sizeof(V) + done, from + done, (int) std::min<long long>(spill_chunk, total - done));
+    }
+    spilled += count, count = 0;
+  }
+  // refills the buffer of run i, false if it is used up
+  bool fill(int i) {
+    run &now = cursors[i];
+    if (now.place == now.end) {
+      return false;
+    }
+    now.at = 0, now.count = (int) std::min<long long>(per_run, now.end - now.place);
+    file.Read(now.place * (long long) sizeof(V), values + (long long) i * per_run, now.count * (int) sizeof(V));
+    now.place += now.count;
+    return true;
+  }
+  const V &front(int i) const {
+    return values[(long long) i * per_run + cursors[i].at];
+  }
+  // the heap keeps the run with the least front on top
+  bool after(int i, int j) const {
+    return less(front(j), front(i));
+  }
+  void start() {
+    merging = true;
+    if (!runs) {
+      std::sort(values, values + count, less);
+      return;
+    }
+    if (count) {
+      spill();
+    }
+    delete[] values;
+    per_run = std::max(1, merge_buffer / (int) sizeof(V));
+    values = new V[(long long) runs * per_run];
+    cursors = new run[runs], heap = new int[runs];
+    for (int i = 0; i < runs; ++i) {
+      cursors[i].place = starts[i], cursors[i].end = i + 1 < runs ? starts[i + 1] : spilled;
+      if (fill(i)) {
+        heap[heap_size++] = i;
+      }
+    }
+    std::make_heap(heap, heap + heap_size, [this](int i, int j) { return after(i, j); });
+  }
+ public:
+  ExternalSort(const std::string &_name, long long run_bytes)
+      : name(_name + "'s runs"), capacity(std::max(1LL, run_bytes / (long long) sizeof(V))) {}
+  ExternalSort(const ExternalSort &) = delete;
+  ExternalSort &operator=(const ExternalSort &) = delete;
+  ~ExternalSort() {
+    delete[] values;
+    delete[] starts;
+    delete[] cursors;
+    delete[] heap;
+    if (runs) {
+      file.Close();
+      std::remove(name.c_str());
+    }
+  }
+
+  // only before the first Next
+  void Add(const V &value) {
+    if (count == room) {
+      room = std::min(capacity, std::max((long long) first_run, 2 * room));
+      V *grown = new V[room];
+      std::copy(values, values + count, grown);
+      delete[] values;
+      values = grown;
+    }
+    values[count++] = value;
+    if (count == capacity) {
+      spill();
+    }
+  }
+
+  // the least value not handed out yet goes to to; false once there is none
+  bool Next(V &to) {
+    if (!merging) {
+      start();
+    }
+    if (!runs) {
+      if (handed == count) {
+        return false;
+      }
+      to = values[handed++];
+      return true;
+    }
+    if (!heap_size) {
+      return false;
+    }
+    auto order = [this](int i, int j) { return after(i, j); };
+    std::pop_heap(heap, heap + heap_size, order);
+    int i = heap[heap_size - 1];
+    to = front(i);
+    if (++cursors[i].at < cursors[i].count || fill(i)) {
+      std::push_heap(heap, heap + heap_size, order);
+    } else {
+      --heap_size;
+    }
+    return true;
+  }
+};
+#endif //BPT__EXTERNALSORT_HPP_
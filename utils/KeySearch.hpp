@@ -0,0 +1,82 @@
+#ifndef BPT__KEYSEARCH_HPP_
+#define BPT__KEYSEARCH_HPP_
+
+#include <cstring>
+#include <type_traits>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BPT_KEYSEARCH_X86
+#endif
+
+/*
+ * @KeySearch
+ * counting how many of the keys of a page lie below a target, several at a time
+ * keys are 64-bit signed integers (SearchOrder maps any integral key onto them
+ * keeping its order), laid out one after another like a column, with no
+ * alignment asked of them
+ * the comparisons use AVX2 or SSE4.2 when the running CPU has them, which is
+ * checked once, and plain adds of the comparison results otherwise; in every
+ * case nothing branches on the keys
+ */
+template<class K>
+inline long long SearchOrder(K key) {
+  if (std::is_unsigned<K>::value && sizeof(K) == sizeof(long long)) {
+    return (long long) ((unsigned long long) key ^ 1ULL << 63);
+  }
+  return (long long) key;
+}
+
+inline int CountLessScalar(const char *keys, int num, long long key) {
+  int ret = 0;
+  long long now;
+  for (int i = 0; i < num; ++i) {
+    memcpy(&now, keys + i * sizeof(long long), sizeof(now));
+    ret += now < key;
+  }
+  return ret;
+}
+
+#ifdef BPT_KEYSEARCH_X86
+__attribute__((target("avx2"))) inline int CountLessAvx2(const char *keys, int num, long long key) {
+  __m256i target = _mm256_set1_epi64x(key), sum = _mm256_setzero_si256();
+  int i = 0;
+  for (; i + 4 <= num; i += 4) {
+    __m256i now = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i * sizeof(long long)));
+    sum = _mm256_sub_epi64(sum, _mm256_cmpgt_epi64(target, now)); // a hit is -1
+  }
+  long long lanes[4];
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes), sum);
+  return (int) (lanes[0] + lanes[1] + lanes[2] + lanes[3]) + CountLessScalar(keys + i * sizeof(long long), num - i, key);
+}
+
+__attribute__((target("sse4.2"))) inline int CountLessSse42(const char *keys, int num, long long key) {
+  __m128i target = _mm_set1_epi64x(key), sum = _mm_setzero_si128();
+  int i = 0;
+  for (; i + 2 <= num; i += 2) {
+    __m128i now = _mm_loadu_si128(reinterpret_cast<const __m128i *>(keys + i * sizeof(long long)));
+    sum = _mm_sub_epi64(sum, _mm_cmpgt_epi64(target, now));
+  }
+  long long lanes[2];
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), sum);
+  return (int) (lanes[0] + lanes[1]) + CountLessScalar(keys + i * sizeof(long long), num - i, key);
+}
+#endif
+
+// how many of the num keys from keys on are below key
+inline int CountLess(const char *keys, int num, long long key) {
+  typedef int (*kernel)(const char *, int, long long);
+  static const kernel chosen = [] {
+#ifdef BPT_KEYSEARCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      return (kernel) CountLessAvx2;
+    }
+    if (__builtin_cpu_supports("sse4.2")) {
+      return (kernel) CountLessSse42;
+    }
+#endif
+    return (kernel) CountLessScalar;
+  }();
+  return chosen(keys, num, key);
+}
+#endif //BPT__KEYSEARCH_HPP_
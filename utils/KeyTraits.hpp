@@ -0,0 +1,87 @@
+#ifndef BPT__KEYTRAITS_HPP_
+#define BPT__KEYTRAITS_HPP_
+
+#include <cstring>
+#include <type_traits>
+
+/*
+ * @KeyTraits
+ * how a key is laid out inside a page: Encode writes the Size bytes of a key,
+ * Decode rebuilds it from them
+ * the default copies the whole object, which is right for fixed-size keys; a key
+ * that wastes most of its object (e.g. a short string in a fixed buffer)
+ * specializes this to store only the bytes it uses, and pages then hold as many
+ * of them as those bytes allow
+ * values are laid out by their traits as well, and always take sizeof(T) bytes
+ * max_size, if a specialization gives it, bounds Size, which is taken to be at
+ * most sizeof(Key) otherwise (see KeyMaxSize); the pages are sized for it
+ * ordered tells that encoded keys compare byte by byte (memcmp, a prefix first)
+ * the way the keys do, which lets separators be cut to a few bytes
+ * normalized tells that, besides, no encoded key is a prefix of another, so what
+ * is written after a key never changes how it compares: a key and a value both
+ * normalized make an element that compares with a single memcmp
+ */
+template<class Key, class = void>
+struct KeyTraits {
+  static const bool ordered = false;
+  static const bool normalized = false;
+  static int Size(const Key &) {
+    return sizeof(Key);
+  }
+  static void Encode(const Key &key, char *to) {
+    memcpy(to, &key, sizeof(Key));
+  }
+  static void Decode(const char *from, int, Key &key) {
+    memcpy(&key, from, sizeof(Key));
+  }
+};
+
+// the most bytes KeyTraits<Key>::Size gives for any key
+template<class Key, class = void>
+struct KeyMaxSize {
+  static const int value = sizeof(Key);
+};
+template<class Key>
+struct KeyMaxSize<Key, decltype((void) KeyTraits<Key>::max_size)> {
+  static const int value = KeyTraits<Key>::max_size;
+};
+
+/*
+ * integers go most significant byte first, with the sign bit flipped so that
+ * negative ones come first
+ */
+template<class Key>
+struct KeyTraits<Key, typename std::enable_if<std::is_integral<Key>::value
+                                                  && !std::is_same<Key, bool>::value>::type> {
+  typedef typename std::make_unsigned<Key>::type word;
+  static const bool ordered = true;
+  static const bool normalized = true;
+  static const word sign = std::is_signed<Key>::value ? (word) ((word) 1 << (8 * sizeof(Key) - 1)) : 0;
+
+  // a word and its bytes, most significant first, into each other
+  static word Turn(word now) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if constexpr (sizeof(word) == 8) {
+      return (word) __builtin_bswap64(now);
+    } else if constexpr (sizeof(word) == 4) {
+      return (word) __builtin_bswap32(now);
+    } else if constexpr (sizeof(word) == 2) {
+      return (word) __builtin_bswap16(now);
+    }
+#endif
+    return now;
+  }
+  static int Size(const Key &) {
+    return sizeof(Key);
+  }
+  static void Encode(const Key &key, char *to) {
+    word now = Turn((word) ((word) key ^ sign));
+    memcpy(to, &now, sizeof(Key));
+  }
+  static void Decode(const char *from, int, Key &key) {
+    word now;
+    memcpy(&now, from, sizeof(Key));
+    key = (Key) (Turn(now) ^ sign);
+  }
+};
+#endif //BPT__KEYTRAITS_HPP_
@@ -0,0 +1,83 @@
+#ifndef BPT__MAPPEDFILE_HPP_
+#define BPT__MAPPEDFILE_HPP_
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include "exceptions.hpp"
+
+const long long map_reserve = 1LL << 40; // address space kept for one file
+const long long map_chunk = 1LL << 24; // the file grows 16 MiB at a time
+
+/*
+ * @MappedFile
+ * a whole file mapped into memory with MAP_SHARED
+ * the mapping covers map_reserve bytes from the very beginning and only the
+ * file underneath grows (by ftruncate), so a pointer handed out by At() never
+ * moves no matter how large the file becomes
+ */
+class MappedFile {
+ private:
+  int fd = -1;
+  char *base = nullptr;
+  long long length = 0; // bytes backed by the file
+ public:
+  MappedFile() = default;
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  ~MappedFile() {
+    Close();
+  }
+
+  // true if the file already existed with some content
+  bool Open(const std::string &name) {
+    fd = ::open(name.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+      throw sjtu::runtime_error();
+    }
+    struct stat info{};
+    fstat(fd, &info);
+    length = info.st_size;
+    void *place = mmap(nullptr, map_reserve, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_NORESERVE, fd, 0);
+    if (place == MAP_FAILED) {
+      ::close(fd), fd = -1;
+      throw sjtu::runtime_error();
+    }
+    base = static_cast<char *>(place);
+    return length > 0;
+  }
+
+  void Close() {
+    if (base) {
+      munmap(base, map_reserve);
+      base = nullptr;
+    }
+    if (fd >= 0) {
+      ::close(fd);
+      fd = -1;
+    }
+  }
+
+  // makes sure [0, size) is backed by the file
+  void Reserve(long long size) {
+    if (size <= length) {
+      return;
+    }
+    long long new_length = (size + map_chunk - 1) / map_chunk * map_chunk;
+    if (new_length > map_reserve) {
+      throw sjtu::runtime_error();
+    }
+    if (ftruncate(fd, new_length) != 0) {
+      throw sjtu::runtime_error();
+    }
+    length = new_length;
+  }
+
+  char *At(long long place) {
+    return base + place;
+  }
+};
+#endif //BPT__MAPPEDFILE_HPP_
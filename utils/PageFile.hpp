@@ -0,0 +1,218 @@
+#ifndef BPT__PAGEFILE_HPP_
+#define BPT__PAGEFILE_HPP_
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string>
+#include "exceptions.hpp"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+const int direct_alignment = 4096; // what buffers, offsets and sizes of direct transfers are multiples of
+
+// memory aligned to direct_alignment, for blocks that may be transferred directly
+inline char *NewAligned(int size) {
+  return static_cast<char *>(::operator new(size, std::align_val_t(direct_alignment)));
+}
+inline void DeleteAligned(char *data) {
+  ::operator delete(data, std::align_val_t(direct_alignment));
+}
+
+/*
+ * @class PageFile
+ * a file accessed only by positional pread/pwrite, so there is no shared
+ * seek pointer or stream buffer: two readers never disturb each other
+ * pages lying next to each other on disk can be moved with one
+ * preadv/pwritev call through ReadPages/WritePages
+ *
+ * opened direct, transfers bypass the kernel's page cache (O_DIRECT, or
+ * F_NOCACHE where that is what the system has), so blocks a buffer pool keeps
+ * are not cached twice; a transfer whose buffer, place or size is not a
+ * multiple of direct_alignment then goes through an aligned copy of the blocks
+ * around it, which for a write means reading them first
+ * a file system refusing O_DIRECT gets the file opened as usual
+ */
+class PageFile {
+ private:
+  int fd = -1;
+  bool direct = false;
+
+  static bool aligned(long long place, const void *obj, long long size) {
+    return place % direct_alignment == 0 && size % direct_alignment == 0
+        && reinterpret_cast<std::uintptr_t>(obj) % direct_alignment == 0;
+  }
+ public:
+  PageFile() = default;
+  PageFile(const PageFile &) = delete;
+  PageFile &operator=(const PageFile &) = delete;
+  ~PageFile() {
+    Close();
+  }
+
+  // true if the file already existed with some content
+  bool Open(const std::string &name, bool direct_ = false) {
+    Close();
+    direct = false;
+#ifdef O_DIRECT
+    if (direct_) {
+      fd = ::open(name.c_str(), O_RDWR | O_CREAT | O_DIRECT, 0644);
+      direct = fd >= 0;
+    }
+#endif
+    if (fd < 0) {
+      fd = ::open(name.c_str(), O_RDWR | O_CREAT, 0644);
+    }
+    if (fd < 0) {
+      throw sjtu::runtime_error();
+    }
+#if !defined(O_DIRECT) && defined(F_NOCACHE)
+    if (direct_) {
+      fcntl(fd, F_NOCACHE, 1); // no alignment asked
+    }
+#endif
+    struct stat info{};
+    fstat(fd, &info);
+    return info.st_size > 0;
+  }
+
+  void Close() {
+    if (fd >= 0) {
+      ::close(fd);
+      fd = -1;
+    }
+  }
+
+  long long Size() const {
+    struct stat info{};
+    fstat(fd, &info);
+    return info.st_size;
+  }
+
+  void Truncate(long long size) const {
+    if (ftruncate(fd, size) != 0) {
+      throw sjtu::runtime_error();
+    }
+  }
+
+  // waits until what was written is on the disk
+  void Sync() const {
+    if (fdatasync(fd) != 0) {
+      throw sjtu::runtime_error();
+    }
+  }
+
+  // bytes past the end of the file read as zero
+  void Read(long long place, void *obj, int size) const {
+    if (direct && !aligned(place, obj, size)) {
+      Bounce(place, static_cast<char *>(obj), size, false);
+      return;
+    }
+    char *now = static_cast<char *>(obj);
+    while (size > 0) {
+      ssize_t done = pread(fd, now, size, place);
+      if (done < 0) {
+        throw sjtu::runtime_error();
+      }
+      // a direct read only comes up short at the end, and could not go on unaligned
+      if (done == 0 || (direct && done < size)) {
+        memset(now + done, 0, size - done);
+        return;
+      }
+      now += done, place += done, size -= done;
+    }
+  }
+
+  void Write(long long place, const void *obj, int size) const {
+    if (direct && !aligned(place, obj, size)) {
+      Bounce(place, static_cast<char *>(const_cast<void *>(obj)), size, true);
+      return;
+    }
+    const char *now = static_cast<const char *>(obj);
+    while (size > 0) {
+      ssize_t done = pwrite(fd, now, size, place);
+      if (done < 0) {
+        throw sjtu::runtime_error();
+      }
+      now += done, place += done, size -= done;
+    }
+  }
+
+  /*
+   * count pages of the same size, stored back to back from place on
+   */
+  void ReadPages(long long place, void *const *objs, int count, int size) const {
+    Transfer(place, const_cast<void **>(objs), count, size, false);
+  }
+  void WritePages(long long place, const void *const *objs, int count, int size) const {
+    Transfer(place, const_cast<void **>(objs), count, size, true);
+  }
+
+ private:
+  // a transfer O_DIRECT cannot take as it is, done over an aligned copy of its blocks
+  void Bounce(long long place, char *obj, int size, bool out) const {
+    long long begin = place / direct_alignment * direct_alignment;
+    long long end = (place + size + direct_alignment - 1) / direct_alignment * direct_alignment;
+    char *blocks = NewAligned((int) (end - begin));
+    try {
+      Read(begin, blocks, (int) (end - begin));
+      if (out) {
+        memcpy(blocks + (place - begin), obj, size);
+        Write(begin, blocks, (int) (end - begin));
+      } else {
+        memcpy(obj, blocks + (place - begin), size);
+      }
+    } catch (...) {
+      DeleteAligned(blocks);
+      throw;
+    }
+    DeleteAligned(blocks);
+  }
+
+  void Transfer(long long place, void **objs, int count, int size, bool out) const {
+    bool one_by_one = false; // some page O_DIRECT cannot take: each goes through Read or Write
+    for (int i = 0; direct && !one_by_one && i < count; ++i) {
+      one_by_one = !aligned(place + 1LL * i * size, objs[i], size);
+    }
+    if (one_by_one) {
+      for (int i = 0; i < count; ++i) {
+        if (out) {
+          Write(place + 1LL * i * size, objs[i], size);
+        } else {
+          Read(place + 1LL * i * size, objs[i], size);
+        }
+      }
+      return;
+    }
+    iovec vec[IOV_MAX];
+    while (count > 0) {
+      int num = count < IOV_MAX ? count : IOV_MAX;
+      long long total = 1LL * num * size;
+      for (int i = 0; i < num; ++i) {
+        vec[i].iov_base = objs[i], vec[i].iov_len = size;
+      }
+      ssize_t done = out ? pwritev(fd, vec, num, place) : preadv(fd, vec, num, place);
+      if (done < 0) {
+        throw sjtu::runtime_error();
+      }
+      if (done < total) { // short transfer, finish page by page
+        for (int i = static_cast<int>(done / size); i < num; ++i) {
+          if (out) {
+            Write(place + 1LL * i * size, objs[i], size);
+          } else {
+            Read(place + 1LL * i * size, objs[i], size);
+          }
+        }
+      }
+      place += total, objs += num, count -= num;
+    }
+  }
+};
+#endif //BPT__PAGEFILE_HPP_
@@ -0,0 +1,125 @@
+#ifndef BPT__PAGELATCH_HPP_
+#define BPT__PAGELATCH_HPP_
+
+#include <atomic>
+#include <thread>
+#include "exceptions.hpp"
+
+const int latch_chunk_bits = 16; // latches of 1 << latch_chunk_bits pages are allocated together
+const int latch_chunks = 1 << 16;
+
+/*
+ * @class PageLatches
+ * a reader/writer latch for every page of a file, found by the page number
+ * alone, so cached and mapped pages are latched alike and no frame has to
+ * outlive its latch; latches come in chunks, allocated the first time a page
+ * of theirs is latched and kept until the object goes
+ * a latch is one word: readers in the low bits, a bit for the writer holding
+ * it and one for writers waiting, which keeps new readers out so that a stream
+ * of them cannot starve a writer, and in the high half a version, counting the
+ * times the latch was let go by a writer
+ * waiting spins, giving up the CPU every round: a latch is held only while a
+ * page is looked at or changed
+ * latches are not reentrant, in either mode
+ *
+ * readers may also go without the latch and write nothing at all: Snapshot
+ * gives the version once no writer holds it, the page is read (copied, as it
+ * may change meanwhile), and Validate tells whether the copy is good, that is
+ * whether the latch is still unheld at that version (optimistic lock coupling)
+ */
+class PageLatches {
+ private:
+  typedef unsigned long long word;
+  static const word held = 1ULL << 31, waiting = 1ULL << 30, readers = waiting - 1, version = 1ULL << 32;
+  std::atomic<std::atomic<word> *> *chunks;
+
+  std::atomic<word> &at(long long page) {
+    if (page < 0 || page >> latch_chunk_bits >= latch_chunks) {
+      throw sjtu::runtime_error();
+    }
+    std::atomic<std::atomic<word> *> &chunk = chunks[page >> latch_chunk_bits];
+    std::atomic<word> *now = chunk.load(std::memory_order_acquire);
+    if (!now) {
+      auto *fresh = new std::atomic<word>[1 << latch_chunk_bits]();
+      if (chunk.compare_exchange_strong(now, fresh, std::memory_order_acq_rel)) {
+        now = fresh;
+      } else { // someone else got there first
+        delete[] fresh;
+      }
+    }
+    return now[page & ((1 << latch_chunk_bits) - 1)];
+  }
+ public:
+  PageLatches() : chunks(new std::atomic<std::atomic<word> *>[latch_chunks]()) {}
+  PageLatches(const PageLatches &) = delete;
+  PageLatches &operator=(const PageLatches &) = delete;
+  ~PageLatches() {
+    for (int i = 0; i < latch_chunks; ++i) {
+      delete[] chunks[i].load();
+    }
+    delete[] chunks;
+  }
+
+  void LockShared(long long page) {
+    std::atomic<word> &latch = at(page);
+    for (word now = latch.load(std::memory_order_relaxed);;) {
+      if (now & (held | waiting)) {
+        std::this_thread::yield();
+        now = latch.load(std::memory_order_relaxed);
+      } else if (latch.compare_exchange_weak(now, now + 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+        return;
+      }
+    }
+  }
+  void UnlockShared(long long page) {
+    at(page).fetch_sub(1, std::memory_order_release);
+  }
+
+  void Lock(long long page) {
+    std::atomic<word> &latch = at(page);
+    for (word now = latch.load(std::memory_order_relaxed);;) {
+      if (!(now & (held | readers))) {
+        if (latch.compare_exchange_weak(now, (now & ~waiting) | held, std::memory_order_acquire,
+                                        std::memory_order_relaxed)) {
+          // optimistic readers seeing any change of the page see the latch held as well
+          std::atomic_thread_fence(std::memory_order_release);
+          return;
+        }
+      } else if (!(now & waiting)) {
+        if (latch.compare_exchange_weak(now, now | waiting, std::memory_order_relaxed)) {
+          now |= waiting;
+        }
+      } else {
+        std::this_thread::yield();
+        now = latch.load(std::memory_order_relaxed);
+      }
+    }
+  }
+  // lets go of the latch and moves its version on
+  void Unlock(long long page) {
+    at(page).fetch_add(version - held, std::memory_order_release);
+  }
+
+  // how many times a writer let go of the latch; only stable while it is held
+  unsigned Version(long long page) {
+    return (unsigned) (at(page).load(std::memory_order_acquire) >> 32);
+  }
+
+  // the version of the latch, as soon as no writer holds it
+  unsigned Snapshot(long long page) {
+    std::atomic<word> &latch = at(page);
+    word now = latch.load(std::memory_order_acquire);
+    while (now & held) {
+      std::this_thread::yield();
+      now = latch.load(std::memory_order_acquire);
+    }
+    return (unsigned) (now >> 32);
+  }
+  // whether no writer took the latch since Snapshot gave seen, so what was read in between holds
+  bool Validate(long long page, unsigned seen) {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    word now = at(page).load(std::memory_order_relaxed);
+    return !(now & held) && (unsigned) (now >> 32) == seen;
+  }
+};
+#endif //BPT__PAGELATCH_HPP_
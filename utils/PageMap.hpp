@@ -0,0 +1,173 @@
+#ifndef BPT__PAGEMAP_HPP_
+#define BPT__PAGEMAP_HPP_
+
+#include <cstdint>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+ * @class PageMap
+ * an open-addressing hashmap from 64-bit page ids to pointers, laid out like
+ * SwissTable: slots come in groups of 16, each slot has a control byte holding
+ * 7 bits of the hash (or empty / deleted), and a lookup compares all 16 control
+ * bytes of a group at once before touching any key
+ * the table is a power of two in size and rebuilt before more than 7/8 of it is
+ * used (live entries plus tombstones), so probe sequences stay short however
+ * many pages are cached
+ */
+template<class V>
+class PageMap {
+ private:
+  static const int group = 16;
+  static const int8_t empty = -128; // 0b10000000
+  static const int8_t deleted = -2; // 0b11111110
+  int8_t *control = nullptr;
+  long long *keys = nullptr;
+  V **values = nullptr;
+  size_t capacity = 0, size = 0, tombs = 0;
+
+  static uint64_t mix(uint64_t id) { // murmur3 finalizer
+    id ^= id >> 33;
+    id *= 0xff51afd7ed558ccdULL;
+    id ^= id >> 33;
+    id *= 0xc4ceb9fe1a85ec53ULL;
+    id ^= id >> 33;
+    return id;
+  }
+
+  // bit i set if the i-th control byte of the group starting at pos equals tag
+  uint32_t match(size_t pos, int8_t tag) const {
+#ifdef __SSE2__
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(control + pos));
+    return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(tag)));
+#else
+    uint32_t ret = 0;
+    for (int i = 0; i < group; ++i) {
+      ret |= (uint32_t) (control[pos + i] == tag) << i;
+    }
+    return ret;
+#endif
+  }
+
+  // bit i set if the i-th slot of the group is empty or deleted (both have the top bit)
+  uint32_t match_free(size_t pos) const {
+#ifdef __SSE2__
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(control + pos));
+    return (uint32_t) _mm_movemask_epi8(bytes);
+#else
+    uint32_t ret = 0;
+    for (int i = 0; i < group; ++i) {
+      ret |= (uint32_t) (control[pos + i] < 0) << i;
+    }
+    return ret;
+#endif
+  }
+
+  // slot holding id, or capacity if there is none
+  size_t locate(long long id) const {
+    if (!capacity) {
+      return 0;
+    }
+    uint64_t hash = mix(id);
+    auto tag = (int8_t) (hash & 0x7f);
+    size_t mask = capacity / group - 1, pos = (hash >> 7) & mask;
+    for (size_t step = 1;; ++step) {
+      size_t start = pos * group;
+      for (uint32_t hit = match(start, tag); hit; hit &= hit - 1) {
+        size_t slot = start + __builtin_ctz(hit);
+        if (keys[slot] == id) {
+          return slot;
+        }
+      }
+      if (match(start, empty)) {
+        return capacity;
+      }
+      pos = (pos + step) & mask; // triangular numbers visit every group
+    }
+  }
+
+  // places an id known to be absent
+  void place(long long id, V *value) {
+    uint64_t hash = mix(id);
+    size_t mask = capacity / group - 1, pos = (hash >> 7) & mask;
+    for (size_t step = 1;; ++step) {
+      size_t start = pos * group;
+      uint32_t hit = match_free(start);
+      if (hit) {
+        size_t slot = start + __builtin_ctz(hit);
+        if (control[slot] == deleted) {
+          --tombs;
+        }
+        control[slot] = (int8_t) (hash & 0x7f);
+        keys[slot] = id, values[slot] = value;
+        ++size;
+        return;
+      }
+      pos = (pos + step) & mask;
+    }
+  }
+
+  void rebuild(size_t new_capacity) {
+    int8_t *old_control = control;
+    long long *old_keys = keys;
+    V **old_values = values;
+    size_t old_capacity = capacity;
+    capacity = new_capacity, size = 0, tombs = 0;
+    control = new int8_t[capacity];
+    keys = new long long[capacity];
+    values = new V *[capacity];
+    memset(control, empty, capacity);
+    for (size_t i = 0; i < old_capacity; ++i) {
+      if (old_control[i] >= 0) {
+        place(old_keys[i], old_values[i]);
+      }
+    }
+    delete[] old_control, delete[] old_keys, delete[] old_values;
+  }
+
+ public:
+  PageMap() {
+    rebuild(group * 4);
+  }
+  PageMap(const PageMap &) = delete;
+  PageMap &operator=(const PageMap &) = delete;
+  ~PageMap() {
+    delete[] control, delete[] keys, delete[] values;
+  }
+
+  V *Find(long long id) const {
+    size_t slot = locate(id);
+    return slot == capacity ? nullptr : values[slot];
+  }
+
+  // id must not be in the map yet
+  void Insert(long long id, V *value) {
+    if ((size + tombs + 1) * 8 > capacity * 7) {
+      // mostly tombstones: clean up in place; otherwise double
+      rebuild(size * 2 < capacity ? capacity : capacity * 2);
+    }
+    place(id, value);
+  }
+
+  void Erase(long long id) {
+    size_t slot = locate(id);
+    if (slot == capacity) {
+      return;
+    }
+    // a group with a free slot never made a probe go on, so nothing needs the tombstone
+    size_t start = slot / group * group;
+    if (match(start, empty)) {
+      control[slot] = empty;
+    } else {
+      control[slot] = deleted, ++tombs;
+    }
+    --size;
+  }
+
+  size_t Size() const {
+    return size;
+  }
+};
+#endif //BPT__PAGEMAP_HPP_
@@ -0,0 +1,90 @@
+#ifndef BPT__POSTINGCODEC_HPP_
+#define BPT__POSTINGCODEC_HPP_
+
+#include <cstring>
+#include <type_traits>
+
+/*
+ * @PostingCodec
+ * how a sorted run of values is stored in a posting list: Encode writes
+ * values [begin, end) of a sorted array-like, Decode hands them back in order
+ * integral values are kept as varint gaps from the value before (the first one
+ * zigzagged), so a run of close values takes a byte or two each; anything
+ * else is copied as it is
+ * MaxSize bounds the bytes a single value can take, First reads just the first one
+ */
+template<class T, bool Integral = std::is_integral<T>::value>
+struct PostingCodec {
+  static constexpr int MaxSize() {
+    return sizeof(T);
+  }
+  template<class V>
+  static int Encode(const V &values, int begin, int end, char *to) {
+    for (int i = begin; i < end; ++i) {
+      memcpy(to + (i - begin) * sizeof(T), &values[i], sizeof(T));
+    }
+    return (end - begin) * (int) sizeof(T);
+  }
+  static T First(const char *from) {
+    T ret;
+    memcpy(&ret, from, sizeof(T));
+    return ret;
+  }
+  template<class F>
+  static void Decode(const char *from, int size, F emit) {
+    T now;
+    for (int i = 0; i + (int) sizeof(T) <= size; i += sizeof(T)) {
+      memcpy(&now, from + i, sizeof(T));
+      emit(now);
+    }
+  }
+};
+
+template<class T>
+struct PostingCodec<T, true> {
+  typedef unsigned long long word;
+
+  static constexpr int MaxSize() {
+    return 10;
+  }
+  template<class V>
+  static int Encode(const V &values, int begin, int end, char *to) {
+    int size = 0;
+    word last = 0;
+    for (int i = begin; i < end; ++i) {
+      auto now = (word) (long long) values[i];
+      // the first value may be negative: zigzag it; gaps never are
+      word gap = i == begin ? now << 1 ^ (word) ((long long) now >> 63) : now - last;
+      while (gap >= 0x80) {
+        to[size++] = (char) ((gap & 0x7f) | 0x80);
+        gap >>= 7;
+      }
+      to[size++] = (char) gap;
+      last = now;
+    }
+    return size;
+  }
+  template<class F>
+  static void Decode(const char *from, int size, F emit) {
+    word last = 0;
+    for (int i = 0; i < size;) {
+      bool first = i == 0;
+      word gap = 0;
+      for (int shift = 0;; shift += 7) {
+        auto byte = (unsigned char) from[i++];
+        gap |= (word) (byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+          break;
+        }
+      }
+      last = first ? gap >> 1 ^ (word) -(long long) (gap & 1) : last + gap;
+      emit((T) (long long) last);
+    }
+  }
+  static T First(const char *from) {
+    T ret{};
+    Decode(from, 1, [&ret](const T &now) { ret = now; }); // a size of 1 stops after one value
+    return ret;
+  }
+};
+#endif //BPT__POSTINGCODEC_HPP_
@@ -0,0 +1,165 @@
+#ifndef BPT__SLOTTEDPAGE_HPP_
+#define BPT__SLOTTEDPAGE_HPP_
+
+#include <cstring>
+#include <type_traits>
+
+/*
+ * @class SlottedPage
+ * Capacity bytes holding variable-length records in order
+ * an array of slots grows from the front, one (offset, size) pair per record,
+ * while the records themselves are packed from the back; a record erased in the
+ * middle only leaves a hole, which is reclaimed when an insertion needs the room
+ * the page is plain bytes, so it can be stored and copied as it is
+ *
+ * with a Column (a class whose static Of(record) gives a 64-bit key for a
+ * record) the page also keeps those keys, in record order, as one array in
+ * front of the slots, so a search can run over contiguous keys without touching
+ * the records; Replace keeps a changed record's key up to date
+ */
+const int slotted_header = 4 * sizeof(unsigned short);
+
+template<int Capacity, class Column = void>
+class SlottedPage {
+  static_assert(Capacity < 65536, "offsets are 16 bits");
+  static const bool keyed = !std::is_void<Column>::value;
+ public:
+  static const int column_size = keyed ? sizeof(long long) : 0;
+  static const int slot_size = 2 * sizeof(unsigned short) + column_size;
+ private:
+  // top: where the packed records start; spare keeps bytes, and the column, 8-byte aligned
+  unsigned short count = 0, top = Capacity, dead = 0, spare = 0;
+  char bytes[Capacity];
+
+  unsigned short *slot(int i) {
+    return reinterpret_cast<unsigned short *>(bytes + count * column_size) + 2 * i;
+  }
+  const unsigned short *slot(int i) const {
+    return reinterpret_cast<const unsigned short *>(bytes + count * column_size) + 2 * i;
+  }
+  void set_key(int i) {
+    if constexpr (keyed) {
+      long long key = Column::Of(Record(i));
+      memcpy(bytes + i * column_size, &key, sizeof(key));
+    }
+  }
+
+  // packs the records again, closing every hole
+  void compact() {
+    char temp[Capacity];
+    int now = Capacity;
+    for (int i = 0; i < count; ++i) {
+      now -= slot(i)[1];
+      memcpy(temp + now, bytes + slot(i)[0], slot(i)[1]);
+      slot(i)[0] = (unsigned short) now;
+    }
+    memcpy(bytes + now, temp + now, Capacity - now);
+    top = (unsigned short) now, dead = 0;
+  }
+
+ public:
+  int Count() const {
+    return count;
+  }
+  const char *Record(int i) const {
+    return bytes + slot(i)[0];
+  }
+  char *Record(int i) {
+    return bytes + slot(i)[0];
+  }
+  int Size(int i) const {
+    return slot(i)[1];
+  }
+  // the column: Count() keys of column_size bytes each
+  const char *Keys() const {
+    return bytes;
+  }
+
+  // bytes taken by slots and records
+  int Used() const {
+    return count * slot_size + (Capacity - top - dead);
+  }
+  int Free() const {
+    return Capacity - Used();
+  }
+
+  /*
+   * a copy of other, reading only the bytes in use: the slots in front and the
+   * records from top on; other may be changing meanwhile, for an optimistic
+   * reader checks afterwards whether it did, so whatever its header says, the
+   * copy stays within the page
+   */
+  void CopyFrom(const SlottedPage &other) {
+    count = other.count, top = other.top, dead = other.dead, spare = other.spare;
+    int front = count * slot_size, back = top;
+    memcpy(bytes, other.bytes, front < Capacity ? front : Capacity);
+    if (back < Capacity) {
+      memcpy(bytes + back, other.bytes + back, Capacity - back);
+    }
+  }
+
+  void Clear() {
+    count = 0, top = Capacity, dead = 0;
+  }
+
+  // puts a record in front of the i-th one (0-based), false if it does not fit
+  bool Insert(int i, const void *record, int size) {
+    if (Free() < size + slot_size) {
+      return false;
+    }
+    if (top - count * slot_size < size + slot_size) {
+      compact();
+    }
+    top -= size;
+    memcpy(bytes + top, record, size);
+    const int pair = 2 * sizeof(unsigned short);
+    char *slots = bytes + count * column_size;
+    // the slots make room for one more key in front of them, and for the new slot
+    memmove(slots + column_size + (i + 1) * pair, slots + i * pair, (count - i) * pair);
+    memmove(slots + column_size, slots, i * pair);
+    memmove(bytes + (i + 1) * column_size, bytes + i * column_size, (count - i) * column_size);
+    ++count;
+    slot(i)[0] = top, slot(i)[1] = (unsigned short) size;
+    set_key(i);
+    return true;
+  }
+  bool Append(const void *record, int size) {
+    return Insert(count, record, size);
+  }
+
+  void Erase(int i) {
+    if (slot(i)[0] == top) {
+      top += slot(i)[1];
+    } else {
+      dead += slot(i)[1];
+    }
+    const int pair = 2 * sizeof(unsigned short);
+    char *slots = bytes + count * column_size;
+    memmove(bytes + i * column_size, bytes + (i + 1) * column_size, (count - i - 1) * column_size);
+    memmove(slots - column_size, slots, i * pair);
+    memmove(slots - column_size + i * pair, slots + (i + 1) * pair, (count - i - 1) * pair);
+    --count;
+  }
+
+  // whether the i-th record could be replaced by one of size bytes
+  bool Fits(int i, int size) const {
+    return Free() + Size(i) >= size;
+  }
+  // replaces the i-th record, false (leaving it alone) if the new one does not fit
+  bool Replace(int i, const void *record, int size) {
+    if (!Fits(i, size)) {
+      return false;
+    }
+    if (size <= Size(i)) {
+      memmove(Record(i), record, size);
+      dead += Size(i) - size, slot(i)[1] = (unsigned short) size;
+      set_key(i);
+      return true;
+    }
+    char temp[Capacity];
+    memcpy(temp, record, size);
+    Erase(i);
+    return Insert(i, temp, size);
+  }
+};
+#endif //BPT__SLOTTEDPAGE_HPP_
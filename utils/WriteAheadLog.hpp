@@ -0,0 +1,313 @@
+#ifndef BPT__WRITEAHEADLOG_HPP_
+#define BPT__WRITEAHEADLOG_HPP_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "PageFile.hpp"
+
+const int group_commit_ms = 5; // longest a record waits in memory before its fsync
+const int group_bytes = 1 << 20; // or until this much is waiting
+const long long log_limit = 64LL << 20; // records a tree lets pile up before a checkpoint
+const int journal_chunk = 1 << 20;
+const long long journal_magic = 0x4250544a524e4cLL;
+const int journal_files = 8;
+const unsigned fnv_basis = 2166136261u;
+
+/*
+ * @class WriteAheadLog
+ * an append-only log of logical operations, each a record of raw bytes tagged
+ * with an increasing lsn and a checksum
+ * Append only copies the record into memory; a commit thread writes whatever has
+ * gathered every group_commit_ms milliseconds with a single write and fdatasync,
+ * so one fsync covers every operation of that window (Commit waits for it)
+ *
+ * the log is cut at checkpoints; a checkpoint must reach the files as a whole,
+ * so its pages first go to a journal ("<name>'s journal"): Stage copies them
+ * there, Seal makes the journal durable, then the caller writes the pages in
+ * place and Finish syncs the files and empties journal and log
+ * a sealed journal found by Open is written out again, so a crash in the
+ * middle of a checkpoint leaves either the old or the new one on disk
+ */
+class WriteAheadLog {
+ private:
+  struct record {
+    long long lsn;
+    int size;
+    char op;
+    unsigned check;
+  };
+  struct entry { // a journaled page, file == -1 seals the journal
+    int file;
+    int size;
+    long long place;
+  };
+  // a growing byte buffer
+  struct buffer {
+    char *data = nullptr;
+    int size = 0, capacity = 0;
+    ~buffer() {
+      delete[] data;
+    }
+    void append(const void *obj, int num) {
+      if (size + num > capacity) {
+        int new_capacity = capacity ? capacity : 4096;
+        while (new_capacity < size + num) {
+          new_capacity <<= 1;
+        }
+        char *new_data = new char[new_capacity];
+        if (size) {
+          memcpy(new_data, data, size);
+        }
+        delete[] data;
+        data = new_data, capacity = new_capacity;
+      }
+      memcpy(data + size, obj, num);
+      size += num;
+    }
+  };
+
+  PageFile log, journal;
+  PageFile *files[journal_files] = {nullptr};
+  int file_num = 0;
+  long long log_end = 0, journal_end = 0; // where the next write goes
+  unsigned journal_check = fnv_basis; // over everything staged since the last Finish
+  buffer waiting, staged; // records not written yet / journal entries not written yet
+  long long last_lsn = 0, durable_lsn = 0;
+  std::mutex latch;
+  std::condition_variable wake, done;
+  std::thread committer;
+  bool stopping = false, writing = false, hurry = false;
+
+  static unsigned fnv(const void *obj, int size, unsigned hash = fnv_basis) {
+    const auto *now = static_cast<const unsigned char *>(obj);
+    for (int i = 0; i < size; ++i) {
+      hash = (hash ^ now[i]) * 16777619u;
+    }
+    return hash;
+  }
+  static unsigned checksum(const record &head, const void *payload) {
+    unsigned hash = fnv(&head.lsn, sizeof(head.lsn));
+    hash = fnv(&head.size, sizeof(head.size), hash);
+    hash = fnv(&head.op, sizeof(head.op), hash);
+    return fnv(payload, head.size, hash);
+  }
+
+  void commit_loop() {
+    std::unique_lock<std::mutex> lock(latch);
+    buffer out;
+    while (true) {
+      wake.wait_for(lock, std::chrono::milliseconds(group_commit_ms),
+                    [this] { return stopping || hurry || waiting.size >= group_bytes; });
+      if (waiting.size) {
+        std::swap(out.data, waiting.data), std::swap(out.capacity, waiting.capacity);
+        int size = waiting.size;
+        long long upto = last_lsn, place = log_end;
+        waiting.size = 0, log_end += size, writing = true;
+        lock.unlock();
+        log.Write(place, out.data, size);
+        log.Sync();
+        lock.lock();
+        durable_lsn = upto, writing = false;
+        done.notify_all();
+      }
+      hurry = false;
+      if (stopping) {
+        break;
+      }
+    }
+  }
+
+  void flush_staged() {
+    journal.Write(journal_end, staged.data, staged.size);
+    journal_end += staged.size, staged.size = 0;
+  }
+
+ public:
+  WriteAheadLog() = default;
+  WriteAheadLog(const WriteAheadLog &) = delete;
+  WriteAheadLog &operator=(const WriteAheadLog &) = delete;
+  ~WriteAheadLog() {
+    Close();
+  }
+
+  // a file pages may be journaled for, referred to by the returned index
+  int Attach(PageFile &file) {
+    files[file_num] = &file;
+    return file_num++;
+  }
+
+  /*
+   * opens the log and redoes a sealed journal left by an interrupted checkpoint
+   * true if it did, in which case the attached files have changed underneath
+   */
+  bool Open(const std::string &name) {
+    log.Open(name);
+    bool redone = false;
+    if (journal.Open(name + "'s journal")) {
+      long long size = journal.Size(), place = 0;
+      unsigned hash = fnv_basis;
+      entry now{};
+      char *page = nullptr;
+      int page_size = 0;
+      // first make sure the seal is there, then write everything out
+      for (int round = 0; round < 2; ++round) {
+        place = 0, hash = fnv_basis;
+        while (place + (long long) sizeof(entry) <= size) {
+          journal.Read(place, &now, sizeof(now));
+          place += sizeof(now);
+          if (now.file == -1 || now.file >= file_num || now.size < 0 || place + now.size > size) {
+            break;
+          }
+          if (now.size > page_size) {
+            delete[] page;
+            page = new char[now.size], page_size = now.size;
+          }
+          journal.Read(place, page, now.size);
+          place += now.size;
+          hash = fnv(&now, sizeof(now), hash);
+          hash = fnv(page, now.size, hash);
+          if (round == 1) {
+            files[now.file]->Write(now.place, page, now.size);
+          }
+        }
+        if (now.file != -1 || now.place != (journal_magic ^ hash)) {
+          break; // torn: the checkpoint never started writing in place
+        }
+        redone = round == 1;
+      }
+      delete[] page;
+      if (redone) {
+        for (int i = 0; i < file_num; ++i) {
+          files[i]->Sync();
+        }
+      }
+      journal.Truncate(0);
+      journal.Sync();
+    }
+    return redone;
+  }
+
+  /*
+   * hands every intact record after lsn after to apply(op, payload, size), in order,
+   * then starts committing new ones behind them; a torn tail is dropped
+   */
+  template<class F>
+  void Replay(long long after, F apply) {
+    long long size = log.Size(), place = 0;
+    record head{};
+    char *payload = nullptr;
+    int payload_size = 0;
+    last_lsn = after;
+    while (place + (long long) sizeof(record) <= size) {
+      log.Read(place, &head, sizeof(head));
+      if (head.size < 0 || place + (long long) sizeof(record) + head.size > size) {
+        break;
+      }
+      if (head.size > payload_size) {
+        delete[] payload;
+        payload = new char[head.size], payload_size = head.size;
+      }
+      log.Read(place + sizeof(record), payload, head.size);
+      if (head.check != checksum(head, payload)) {
+        break;
+      }
+      if (head.lsn > after) {
+        apply(head.op, payload, head.size);
+      }
+      if (head.lsn > last_lsn) {
+        last_lsn = head.lsn;
+      }
+      place += sizeof(record) + head.size;
+    }
+    delete[] payload;
+    log.Truncate(place);
+    log_end = place, durable_lsn = last_lsn;
+    stopping = false;
+    committer = std::thread(&WriteAheadLog::commit_loop, this);
+  }
+
+  void Close() {
+    if (committer.joinable()) {
+      {
+        std::lock_guard<std::mutex> guard(latch);
+        stopping = true;
+      }
+      wake.notify_one();
+      committer.join();
+    }
+  }
+
+  // queues a record and returns its lsn; it is durable once Commit returns
+  long long Append(char op, const void *payload, int size) {
+    std::lock_guard<std::mutex> guard(latch);
+    record head{++last_lsn, size, op, 0};
+    head.check = checksum(head, payload);
+    waiting.append(&head, sizeof(head));
+    waiting.append(payload, size);
+    if (waiting.size >= group_bytes) {
+      wake.notify_one();
+    }
+    return head.lsn;
+  }
+
+  // waits until every record appended so far is on disk
+  void Commit() {
+    std::unique_lock<std::mutex> lock(latch);
+    long long target = last_lsn;
+    if (durable_lsn < target) {
+      hurry = true;
+      wake.notify_one();
+      done.wait(lock, [this, target] { return durable_lsn >= target; });
+    }
+  }
+
+  // the lsn of the last record appended
+  long long Last() {
+    std::lock_guard<std::mutex> guard(latch);
+    return last_lsn;
+  }
+
+  // copies size bytes to go at place of file into the journal
+  void Stage(int file, long long place, const void *obj, int size) {
+    entry head{file, size, place};
+    journal_check = fnv(&head, sizeof(head), journal_check);
+    journal_check = fnv(obj, size, journal_check);
+    staged.append(&head, sizeof(head));
+    staged.append(obj, size);
+    if (staged.size >= journal_chunk) {
+      flush_staged();
+    }
+  }
+
+  // makes the staged pages durable; from here on they survive a crash
+  void Seal() {
+    entry seal{-1, 0, journal_magic ^ journal_check};
+    staged.append(&seal, sizeof(seal));
+    flush_staged();
+    journal.Sync();
+  }
+
+  /*
+   * called once the sealed pages are written in place: syncs the attached files,
+   * then drops the journal and every record up to the checkpoint
+   */
+  void Finish() {
+    for (int i = 0; i < file_num; ++i) {
+      files[i]->Sync();
+    }
+    journal.Truncate(0);
+    journal.Sync();
+    journal_end = 0, journal_check = fnv_basis;
+    std::unique_lock<std::mutex> lock(latch);
+    done.wait(lock, [this] { return !writing; });
+    waiting.size = 0;
+    log.Truncate(0);
+    log.Sync();
+    log_end = 0, durable_lsn = last_lsn;
+  }
+};
+#endif //BPT__WRITEAHEADLOG_HPP_
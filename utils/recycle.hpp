@@ -1,47 +1,55 @@
 #ifndef BPT__RECYCLE_HPP_
 #define BPT__RECYCLE_HPP_
 #include <string>
-#include <fstream>
+#include "PageFile.hpp"
 
 const int max_bin = 1e4 + 5;
 
 struct before {
   int size = 0;
-  int address[max_bin];
+  long long address[max_bin]; // page numbers
 };
 class bin {
  private:
   before store;
-  std::fstream garbage;
+  PageFile garbage;
  public:
   explicit bin(const std::string &bin_name) {
-    garbage.open(bin_name);
-    garbage.seekg(0, std::ios::beg);
-    if (!garbage) {
-      garbage.open(bin_name, std::ios::out);
-      garbage.write(reinterpret_cast<char *>(&store), sizeof(store));
-      garbage.close();
-      garbage.open(bin_name);
+    if (garbage.Open(bin_name)) {
+      Load();
     } else {
-      garbage.read(reinterpret_cast<char *>(&store), sizeof(store));
+      Save();
     }
   }
 
   ~bin() {
-    garbage.seekp(0);
-    garbage.write(reinterpret_cast<char *>(&store), sizeof(store));
-    garbage.close();
+    Save();
   }
+
+  void Load() {
+    garbage.Read(0, &store, sizeof(store));
+  }
+  void Save() {
+    garbage.Write(0, &store, sizeof(store));
+  }
+  // the file the bin lives in and what goes into it, for journaling
+  PageFile &File() {
+    return garbage;
+  }
+  const before &Image() const {
+    return store;
+  }
+
   bool empty() const {
     return !store.size;
   }
 
-  int pop_back() {
+  long long pop_back() {
     // std::cout << store.address[store.size - 1] << "is getting out\n";
     return store.address[--store.size];
   }
 
-  void push_back(const int &todo) {
+  void push_back(const long long &todo) {
     if (store.size == max_bin - 1) return;
     store.address[store.size++] = todo;
   }